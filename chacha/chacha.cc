@@ -13,6 +13,7 @@
 #include <string>
 #include <algorithm>
 #include <sys/random.h>
+#include <random>
 
 static std::string
 state_to_string (const std::array<uint32_t, 16> &s)
@@ -199,4 +200,355 @@ chacha_stream_tests (uint64_t nonce, const std::array<uint8_t, 32> &key)
     assert (orig == buffer);
     printf ("  OK    (AVX2 validation)\n");
   }
+  if (ChaCha::avx512_blocks) {
+    buffer.assign (N, 0);
+    assert (orig != buffer);
+    state = orig_state;
+    for (size_t i = 0; i < buffer.size(); /**/) {
+      ChaCha::avx512_block (state, buffer.data() + i, buffer.data() + i, 20);
+      i += ChaCha::avx512_blocks * 64;
+    }
+    assert (orig == buffer);
+    // counter carry into word 13 within a 16 block batch
+    std::array<uint32_t, 16> carry_state, alu_state;
+    ChaCha::key_setup (carry_state, 256, key, nonce, 0xfffffff5);
+    alu_state = carry_state;
+    std::array<uint8_t, 2 * 16 * 64> carry_buf, alu_buf;
+    ChaCha::avx512_block (carry_state, nullptr, carry_buf.data(), 20);
+    ChaCha::avx512_block (carry_state, nullptr, carry_buf.data() + 16 * 64, 20);
+    for (size_t i = 0; i < alu_buf.size(); i += 64)
+      ChaCha::alu_block (alu_state, nullptr, alu_buf.data() + i, 20);
+    assert (carry_buf == alu_buf && carry_state == alu_state);
+    printf ("  OK    (AVX512 validation)\n");
+  }
+#if defined(__AVX2__)
+  if (ChaCha::avx_blocks) {
+    std::vector<uint8_t> padded (N + 64 + 32, 0);
+    uint8_t *const aligned = (uint8_t*) ((uintptr_t (padded.data()) + 31) & ~uintptr_t (31));
+    for (size_t offset : { 0, 5, 32 }) {
+      state = orig_state;
+      ChaCha::generate_blocks_stream (state, 64 * 3, aligned + offset, 20);
+      ChaCha::generate_blocks_stream (state, N - 64 * 3, aligned + offset + 64 * 3, 20);
+      assert (0 == memcmp (aligned + offset, orig.data(), N));
+    }
+    printf ("  OK    (AVX2 non-temporal validation)\n");
+  }
+#endif
+}
+
+static void
+poly1305_tests ()
+{
+  // RFC8439 2.5.2.
+  const uint8_t key[32] = { 0x85, 0xd6, 0xbe, 0x78, 0x57, 0x55, 0x6d, 0x33, 0x7f, 0x44, 0x52, 0xfe, 0x42, 0xd5, 0x06, 0xa8,
+                            0x01, 0x03, 0x80, 0x8a, 0xfb, 0x0d, 0xb2, 0xfd, 0x4a, 0xbf, 0xf6, 0xaf, 0x41, 0x49, 0xf5, 0x1b };
+  const char *msg = "Cryptographic Forum Research Group";
+  const uint8_t expected[16] = { 0xa8, 0x06, 0x1d, 0xc1, 0x30, 0x51, 0x36, 0xc6, 0xc2, 0x2b, 0x8b, 0xaf, 0x0c, 0x01, 0x27, 0xa9 };
+  uint8_t tag[16];
+  ChaCha::Poly1305 mac (key);
+  mac.update ((const uint8_t*) msg, strlen (msg));
+  mac.finish (tag);
+  assert (0 == memcmp (tag, expected, 16));
+  printf ("  OK    Poly1305 (RFC8439 2.5.2)\n");
+  // SIMD paths and update splits match the scalar path
+  std::vector<uint8_t> data (4099);
+  for (size_t i = 0; i < data.size(); i++)
+    data[i] = i * 0x9E3779B1 >> 24;
+  for (size_t n : { 0, 15, 16, 64, 255, 256, 257, 1000, 1024, 4099 }) {
+    uint8_t ref[16];
+    ChaCha::Poly1305 alu (key, 1);
+    alu.update (data.data(), n);
+    alu.finish (ref);
+    for (unsigned kind : { 2u, 4u, ~0u })
+      for (size_t split : { size_t (0), size_t (7), n / 2 }) {
+        split = std::min (split, n);
+        ChaCha::Poly1305 simd (key, kind);
+        simd.update (data.data(), split);
+        simd.update (data.data() + split, n - split);
+        simd.finish (tag);
+        assert (0 == memcmp (tag, ref, 16));
+      }
+  }
+  printf ("  OK    Poly1305 SIMD paths match the ALU path\n");
+}
+
+static void
+aead_tests ()
+{
+  // RFC8439 2.8.2.
+  const std::array<uint8_t, 32> key = { 0x80, 0x81, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89, 0x8a, 0x8b, 0x8c, 0x8d, 0x8e, 0x8f,
+                                        0x90, 0x91, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0x9b, 0x9c, 0x9d, 0x9e, 0x9f };
+  const std::array<uint8_t, 12> nonce = { 0x07, 0x00, 0x00, 0x00, 0x40, 0x41, 0x42, 0x43, 0x44, 0x45, 0x46, 0x47 };
+  const uint8_t aad[12] = { 0x50, 0x51, 0x52, 0x53, 0xc0, 0xc1, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7 };
+  const char *plaintext = "Ladies and Gentlemen of the class of '99: If I could offer you only one tip for the future, sunscreen would be it.";
+  const uint8_t expected[] = {
+    0xd3, 0x1a, 0x8d, 0x34, 0x64, 0x8e, 0x60, 0xdb, 0x7b, 0x86, 0xaf, 0xbc, 0x53, 0xef, 0x7e, 0xc2,
+    0xa4, 0xad, 0xed, 0x51, 0x29, 0x6e, 0x08, 0xfe, 0xa9, 0xe2, 0xb5, 0xa7, 0x36, 0xee, 0x62, 0xd6,
+    0x3d, 0xbe, 0xa4, 0x5e, 0x8c, 0xa9, 0x67, 0x12, 0x82, 0xfa, 0xfb, 0x69, 0xda, 0x92, 0x72, 0x8b,
+    0x1a, 0x71, 0xde, 0x0a, 0x9e, 0x06, 0x0b, 0x29, 0x05, 0xd6, 0xa5, 0xb6, 0x7e, 0xcd, 0x3b, 0x36,
+    0x92, 0xdd, 0xbd, 0x7f, 0x2d, 0x77, 0x8b, 0x8c, 0x98, 0x03, 0xae, 0xe3, 0x28, 0x09, 0x1b, 0x58,
+    0xfa, 0xb3, 0x24, 0xe4, 0xfa, 0xd6, 0x75, 0x94, 0x55, 0x85, 0x80, 0x8b, 0x48, 0x31, 0xd7, 0xbc,
+    0x3f, 0xf4, 0xde, 0xf0, 0x8e, 0x4b, 0x7a, 0x9d, 0xe5, 0x76, 0xd2, 0x65, 0x86, 0xce, 0xc6, 0x4b,
+    0x61, 0x16,
+  };
+  const uint8_t expected_tag[16] = { 0x1a, 0xe1, 0x0b, 0x59, 0x4f, 0x09, 0xe2, 0x6a, 0x7e, 0x90, 0x2e, 0xcb, 0xd0, 0x60, 0x06, 0x91 };
+  const size_t length = strlen (plaintext);
+  assert (length == sizeof (expected));
+  std::vector<uint8_t> ciphertext (length), decrypted (length);
+  uint8_t tag[16];
+  assert (ChaCha::seal (key, nonce, aad, sizeof (aad), (const uint8_t*) plaintext, length, ciphertext.data(), tag));
+  assert (0 == memcmp (ciphertext.data(), expected, length));
+  assert (0 == memcmp (tag, expected_tag, 16));
+  assert (ChaCha::open (key, nonce, aad, sizeof (aad), ciphertext.data(), length, decrypted.data(), tag));
+  assert (0 == memcmp (decrypted.data(), plaintext, length));
+  printf ("  OK    ChaCha20-Poly1305 (RFC8439 2.8.2)\n");
+  // multi chunk round trip and forgery rejection
+  std::vector<uint8_t> big (100003);
+  for (size_t i = 0; i < big.size(); i++)
+    big[i] = i * 0x9E3779B1 >> 24;
+  ciphertext.resize (big.size());
+  decrypted.resize (big.size());
+  assert (ChaCha::seal (key, nonce, aad, sizeof (aad), big.data(), big.size(), ciphertext.data(), tag));
+  assert (ChaCha::open (key, nonce, aad, sizeof (aad), ciphertext.data(), big.size(), decrypted.data(), tag));
+  assert (decrypted == big);
+  // a forgery is rejected before any plaintext is written
+  ciphertext[big.size() / 2] ^= 1;
+  std::fill (decrypted.begin(), decrypted.end(), 0xa5);
+  assert (!ChaCha::open (key, nonce, aad, sizeof (aad), ciphertext.data(), big.size(), decrypted.data(), tag));
+  assert (std::all_of (decrypted.begin(), decrypted.end(), [] (uint8_t b) { return b == 0xa5; }));
+  printf ("  OK    ChaCha20-Poly1305 round trip and forgery rejection\n");
+  // messages past 2^32 - 1 blocks would wrap the counter into the nonce, they are rejected up front
+  static_assert (ChaCha::AEAD_MAX_LENGTH == 274877906880, "RFC 8439 P_MAX");
+  assert (!ChaCha::seal (key, nonce, aad, sizeof (aad), nullptr, ChaCha::AEAD_MAX_LENGTH + 1, nullptr, tag));
+  assert (!ChaCha::open (key, nonce, aad, sizeof (aad), nullptr, ChaCha::AEAD_MAX_LENGTH + 1, nullptr, tag));
+  printf ("  OK    ChaCha20-Poly1305 length limit\n");
+}
+
+static void
+xchacha_tests ()
+{
+  // draft-irtf-cfrg-xchacha-03 2.2.1.
+  std::array<uint8_t, 32> key;
+  for (size_t i = 0; i < key.size(); i++)
+    key[i] = i;
+  const uint8_t nonce[16] = { 0x00, 0x00, 0x00, 0x09, 0x00, 0x00, 0x00, 0x4a, 0x00, 0x00, 0x00, 0x00, 0x31, 0x41, 0x59, 0x27 };
+  const std::array<uint8_t, 32> expected = { 0x82, 0x41, 0x3b, 0x42, 0x27, 0xb2, 0x7b, 0xfe, 0xd3, 0x0e, 0x42, 0x50, 0x8a, 0x87, 0x7d, 0x73,
+                                             0xa0, 0xf9, 0xe4, 0xd5, 0x8a, 0x74, 0xa8, 0x53, 0xc1, 0x2e, 0xc4, 0x13, 0x26, 0xd3, 0xec, 0xdc };
+  std::array<uint8_t, 32> subkey;
+  ChaCha::hchacha20 (subkey, key, nonce);
+  assert (subkey == expected);
+  printf ("  OK    HChaCha20 (draft-irtf-cfrg-xchacha 2.2.1)\n");
+  // XChaCha20 is ChaCha20 with the subkey and the trailing 64 nonce bits
+  std::array<uint8_t, 24> xnonce;
+  for (size_t i = 0; i < xnonce.size(); i++)
+    xnonce[i] = i < 16 ? nonce[i] : 0xa0 + i;
+  std::array<uint32_t, 16> state, expected_state;
+  ChaCha::xchacha20_setup (state, key, xnonce, 1);
+  ChaCha::rfc7539_setup (expected_state, expected, { 0, 0, 0, 0, 0xb0, 0xb1, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7 }, 1);
+  assert (state == expected_state);
+  // batched setup covers every SIMD width and the ALU tail
+  constexpr size_t N = 16 + 8 + 4 + 3;
+  std::vector<std::array<uint8_t, 24>> nonces (N);
+  for (size_t i = 0; i < N; i++)
+    for (size_t j = 0; j < 24; j++)
+      nonces[i][j] = (i * 24 + j) * 0x9E3779B1 >> 24;
+  std::vector<std::array<uint32_t, 16>> states (N);
+  ChaCha::xchacha20_setup_batch (states.data(), key, nonces.data(), N);
+  for (size_t i = 0; i < N; i++) {
+    ChaCha::xchacha20_setup (state, key, nonces[i]);
+    assert (state == states[i]);
+  }
+  printf ("  OK    XChaCha20 setup, batched for %zu nonces\n", N);
+}
+
+static void
+chacha_seek_tests (uint64_t nonce, const std::array<uint8_t, 32> &key)
+{
+  const size_t N = 300 * 1024;
+  std::vector<uint8_t> ref (N), data (N), out (N);
+  ChaCha::encrypt_range (key, nonce, 0, nullptr, ref.data(), N);
+  for (size_t i = 0; i < N; i++)
+    data[i] = i * 0x9E3779B1 >> 24;
+  for (size_t offset : { 0, 1, 63, 64, 65, 4096, 5000, 77777 })
+    for (size_t length : { 0, 1, 62, 63, 64, 100, 4096, 10000 }) {
+      ChaCha::encrypt_range (key, nonce, offset, data.data(), out.data(), length);
+      for (size_t i = 0; i < length; i++)
+        assert (out[i] == (data[i] ^ ref[offset + i]));
+    }
+  // all kernels and seek across the 32 bit counter boundary
+  constexpr uint64_t START = 0xffffffe0;
+  constexpr size_t NB = 64;
+  std::array<uint32_t, 16> state;
+  ChaCha::key_setup (state, 256, key, nonce, START);
+  for (size_t i = 0; i < NB; i++)
+    ChaCha::alu_block (state, nullptr, out.data() + 64 * i, 20);
+  const std::array<uint32_t, 16> end_state = state;
+  auto check_kernel = [&] (unsigned blocks, auto kernel) {
+    std::array<uint32_t, 16> kstate;
+    for (size_t first : { size_t (0), size_t (1), size_t (3) }) {
+      ChaCha::key_setup (kstate, 256, key, nonce, START + first);
+      size_t i;
+      for (i = first; i + blocks <= NB; i += blocks)
+        kernel (kstate, nullptr, data.data() + 64 * i, 20);
+      assert (0 == memcmp (out.data() + 64 * first, data.data() + 64 * first, 64 * (i - first)));
+      if (first == 0)
+        assert (kstate == end_state);
+    }
+  };
+  if (ChaCha::sse_blocks)
+    check_kernel (ChaCha::sse_blocks, ChaCha::sse_block);
+  if (ChaCha::avx_blocks)
+    check_kernel (ChaCha::avx_blocks, ChaCha::avx2_block<false>);
+  if (ChaCha::avx512_blocks)
+    check_kernel (ChaCha::avx512_blocks, ChaCha::avx512_block);
+  ChaCha::encrypt_range (key, nonce, START * 64 + 28, nullptr, data.data(), NB * 64 - 28);
+  assert (0 == memcmp (out.data() + 28, data.data(), NB * 64 - 28));
+  printf ("  OK    ChaCha encrypt_range() at unaligned offsets\n");
+  for (size_t offset : { 0, 7, 64 }) {
+    ChaCha::encrypt_parallel (key, nonce, offset, nullptr, out.data(), N - offset, 3);
+    assert (0 == memcmp (out.data(), ref.data() + offset, N - offset));
+  }
+  printf ("  OK    ChaCha encrypt_parallel() matches the keystream\n");
+}
+
+static void
+chacha_stream_context_tests (uint64_t nonce, const std::array<uint8_t, 32> &key)
+{
+  const size_t N = 100 * 1024;
+  std::vector<uint8_t> data (N), ref (N), out (N);
+  for (size_t i = 0; i < N; i++)
+    data[i] = i * 0x9E3779B1 >> 24;
+  ChaCha::encrypt_range (key, nonce, 0, data.data(), ref.data(), N);
+  for (size_t step : { 1, 13, 64, 65, 1500, 4096, 9999 }) {
+    ChaCha::Stream stream (key, nonce);
+    for (size_t i = 0; i < N; i += step)
+      stream.update (data.data() + i, out.data() + i, std::min (step, N - i));
+    assert (out == ref);
+  }
+  // irregular chunks, a start offset and keystream output
+  uint64_t x = nonce | 1;
+  for (size_t offset : { 0, 1, 63, 100 }) {
+    ChaCha::Stream stream (key, nonce, offset);
+    for (size_t i = offset, n; i < N; i += n) {
+      x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+      n = std::min (size_t (x % 300), N - i);
+      stream.update (nullptr, out.data() + i, n);
+      for (size_t j = i; j < i + n; j++)
+        assert ((out[j] ^ data[j]) == ref[j]);
+    }
+  }
+  printf ("  OK    ChaCha::Stream output is independent of chunking\n");
+}
+
+static void
+chacha_many_tests ()
+{
+  // 16 + 8 + 4 + 3 messages exercise every lane width and the scalar tail
+  constexpr size_t N = 31;
+  std::vector<std::array<uint32_t, 16>> states (N), ref_states (N);
+  std::vector<std::vector<uint8_t>> data (N), out (N), ref (N);
+  std::vector<ChaCha::Message> messages (N);
+  uint64_t x = 0x9E3779B97F4A7C15;
+  for (size_t i = 0; i < N; i++) {
+    std::array<uint8_t, 32> key;
+    for (auto &k : key) {
+      x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+      k = x;
+    }
+    ChaCha::key_setup (states[i], 256, key, x);
+    if (i % 5 == 0)
+      ChaCha::seek (states[i], 0xffffffffull * 64 - 64);  // one block before the 32 bit counter carry
+    ref_states[i] = states[i];
+    const size_t length = (i * 37) % 300;
+    data[i].resize (length);
+    for (auto &d : data[i])
+      d = x >> 24;
+    out[i].resize (length);
+    ref[i].resize (length);
+    messages[i] = { &states[i], i % 7 == 3 ? nullptr : data[i].data(), out[i].data(), length };
+  }
+  ChaCha::encrypt_many (messages.data(), N);
+  for (size_t i = 0; i < N; i++) {
+    const size_t length = data[i].size();
+    for (size_t pos = 0; pos < length; pos += 64) {
+      uint8_t block[64];
+      ChaCha::alu_block (ref_states[i], nullptr, block, 20);
+      for (size_t j = pos; j < std::min (length, pos + 64); j++)
+        ref[i][j] = block[j - pos] ^ (messages[i].input ? data[i][j] : 0);
+    }
+    assert (out[i] == ref[i]);
+    assert (states[i] == ref_states[i]);
+  }
+  printf ("  OK    ChaCha encrypt_many() matches per message alu_block()\n");
+}
+
+static void
+chacha_rng_tests (const std::array<uint8_t, 32> &seed)
+{
+  // reference: keystream of each key, whose first 32 bytes become the next key
+  constexpr size_t N = 20000;
+  std::vector<uint8_t> ref, block (4 * 64 * ChaCha::chacha_max_blocks);
+  std::array<uint8_t, 32> key = seed;
+  while (ref.size() < N) {
+    std::array<uint32_t, 16> state;
+    ChaCha::key_setup (state, 256, key, 0);
+    for (size_t i = 0; i < block.size(); i += 64)
+      ChaCha::alu_block (state, nullptr, &block[i], 20);
+    memcpy (key.data(), block.data(), 32);
+    ref.insert (ref.end(), block.begin() + 32, block.end());
+  }
+  ChaCha::Rng rng1 (seed), rng2 (seed);
+  std::vector<uint8_t> out (N);
+  uint64_t x = 0x9E3779B97F4A7C15;
+  for (size_t i = 0; i < N; ) {
+    x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+    if (x & 1 && i + 8 <= N) {
+      const uint64_t v = rng1.next64();
+      memcpy (&out[i], &v, 8);
+      i += 8;
+    } else {
+      const size_t n = std::min (size_t (x % 700), N - i);
+      rng1.fill (&out[i], n);
+      i += n;
+    }
+  }
+  assert (memcmp (out.data(), ref.data(), N) == 0);
+  for (size_t i = 0; i < N; i += 8)
+    assert (rng2() == ChaCha::Alu::load32 (&ref[i]) + (uint64_t (ChaCha::Alu::load32 (&ref[i + 4])) << 32));
+  rng2.reseed (seed);
+  std::uniform_int_distribution<int> dist (1, 6);
+  size_t counts[7] = { 0, };
+  for (size_t i = 0; i < 60000; i++)
+    counts[dist (rng2)]++;
+  for (size_t d = 1; d <= 6; d++)
+    assert (counts[d] > 9000 && counts[d] < 11000);
+  printf ("  OK    ChaCha::Rng produces the fast key erasure stream\n");
+}
+
+static void
+chacha_rng_ring_tests (const std::array<uint8_t, 32> &seed)
+{
+  // without inline fallbacks, the ring delivers the stream of its producer Rng
+  ChaCha::Rng seeder (seed);
+  std::array<uint8_t, 32> key;
+  seeder.fill (key.data(), key.size());
+  ChaCha::Rng ref (key);
+  ChaCha::RngRing ring (seed);
+  std::vector<uint8_t> out (4096), expected (4096);
+  for (size_t round = 0; round < 64; round++) {
+    while (ring.available() < out.size())
+      std::this_thread::sleep_for (std::chrono::microseconds (100));
+    for (size_t i = 0, n; i < out.size(); i += n) {
+      n = std::min (size_t (1 + (i * 7 + round) % 61), out.size() - i);
+      ring.fill (&out[i], n);
+    }
+    ref.fill (expected.data(), expected.size());
+    assert (ring.inline_bytes() == 0);
+    assert (out == expected);
+  }
+  // draining the ring falls back to inline generation without blocking
+  std::vector<uint8_t> big (1024 * 1024);
+  ring.fill (big.data(), big.size());
+  assert (ring.inline_bytes() >= big.size());
+  printf ("  OK    ChaCha::RngRing delivers the producer stream\n");
 }
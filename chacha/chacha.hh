@@ -3,7 +3,7 @@
 #ifndef __CHACHA_HH__
 #define __CHACHA_HH__
 
-// ChaCha implementations for ALU, SSE, AVX2, based on Public Domain code from:
+// ChaCha implementations for ALU, SSE, AVX2, AVX-512, based on Public Domain code from:
 // http://cr.yp.to/streamciphers/timings/estreambench/submissions/salsa20/chacha8/ref/chacha.c and CryptoPP
 
 #if defined(__SSE2__)
@@ -21,6 +21,15 @@
 #include <immintrin.h>
 #endif // __AVX2__
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
 
 /// Namespace for the ChaCha cipher
 namespace ChaCha {
@@ -34,6 +43,14 @@ namespace ChaCha {
 [[maybe_unused]] static inline uint64_t aslittle64 (uint64_t v) noexcept { return bswap64 (v); }
 #endif
 
+/// Zero `length` bytes of key material, unlike memset() this is not removed as a dead store before `p` goes out of scope.
+[[maybe_unused]] static inline void
+secure_zero (void *p, size_t length) noexcept
+{
+  memset (p, 0, length);
+  asm volatile ("" : : "r" (p) : "memory");
+}
+
 /// Original ChaCha IV with 64 bit nonce and 64 bit counter.
 static void
 key_setup (std::array<uint32_t, 16> &state, const unsigned keybits, const std::array<uint8_t, 32> &key, uint64_t nonce, uint64_t counter = 0) noexcept
@@ -105,8 +122,23 @@ qround32 (uint32_t &a, uint32_t &b, uint32_t &c, uint32_t &d) noexcept
 }
 } // Alu
 
-static void
-alu_block (std::array<uint32_t, 16> &state, const uint8_t *input, uint8_t *output, unsigned int rounds)
+/** Call `kernel (std::integral_constant<unsigned, R>())` with R = 8, 12 or 20 for ChaCha8/12/20, and R = 0 otherwise.
+ * The kernels take R as their ROUNDS template argument, so the double round loop has a constant trip count
+ * and can be fully unrolled, with ROUNDS = 0 the loop runs over the runtime `rounds` argument.
+ */
+template<class Kernel> static inline void
+dispatch_rounds (unsigned rounds, const Kernel &kernel)
+{
+  switch (rounds) {
+  case 8:  return kernel (std::integral_constant<unsigned, 8>());
+  case 12: return kernel (std::integral_constant<unsigned, 12>());
+  case 20: return kernel (std::integral_constant<unsigned, 20>());
+  default: return kernel (std::integral_constant<unsigned, 0>());
+  }
+}
+
+template<unsigned ROUNDS> static void
+alu_rounds (std::array<uint32_t, 16> &state, const uint8_t *input, uint8_t *output, unsigned int rounds)
 {
   using namespace Alu;
   uint32_t x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, x11, x12, x13, x14, x15;
@@ -115,7 +147,7 @@ alu_block (std::array<uint32_t, 16> &state, const uint8_t *input, uint8_t *outpu
   x8 = state[8];    x9 = state[9];    x10 = state[10];  x11 = state[11];
   x12 = state[12];  x13 = state[13];  x14 = state[14];  x15 = state[15];
 
-  for (int i = static_cast<int>(rounds); i > 0; i -= 2)
+  for (int i = ROUNDS ? int (ROUNDS) : static_cast<int>(rounds); i > 0; i -= 2)
     {
       qround32 (x0, x4,  x8, x12);
       qround32 (x1, x5,  x9, x13);
@@ -168,6 +200,12 @@ alu_block (std::array<uint32_t, 16> &state, const uint8_t *input, uint8_t *outpu
     state[13] += 1; // add with carry
 }
 
+static void
+alu_block (std::array<uint32_t, 16> &state, const uint8_t *input, uint8_t *output, unsigned int rounds)
+{
+  dispatch_rounds (rounds, [&] (auto R) { alu_rounds<R> (state, input, output, rounds); });
+}
+
 // == SSE ==
 // chacha_simd.cpp - written and placed in the public domain by
 //                   Jack Lloyd and Jeffrey Walton
@@ -204,8 +242,8 @@ inline __m128i RotateLeft<16>(const __m128i val)
 }
 } // Sse2
 
-static void
-sse_block (std::array<uint32_t, 16> &state, const uint8_t *input, uint8_t *output, unsigned int rounds)
+template<unsigned ROUNDS> static void
+sse_rounds (std::array<uint32_t, 16> &state, const uint8_t *input, uint8_t *output, unsigned int rounds)
 {
   using namespace Sse2;
   const __m128i state0 = _mm_load_si128(reinterpret_cast<const __m128i*>(&state[0*4]));
@@ -218,22 +256,27 @@ sse_block (std::array<uint32_t, 16> &state, const uint8_t *input, uint8_t *outpu
   __m128i r0_2 = state2;
   __m128i r0_3 = state3;
 
+  // 64 bit counter additions carry into word 13, the same sums are added back after the rounds
+  const __m128i state3_1 = _mm_add_epi64(state3, _mm_set_epi32(0, 0, 0, 1));
+  const __m128i state3_2 = _mm_add_epi64(state3, _mm_set_epi32(0, 0, 0, 2));
+  const __m128i state3_3 = _mm_add_epi64(state3, _mm_set_epi32(0, 0, 0, 3));
+
   __m128i r1_0 = state0;
   __m128i r1_1 = state1;
   __m128i r1_2 = state2;
-  __m128i r1_3 = _mm_add_epi64(r0_3, _mm_set_epi32(0, 0, 0, 1));
+  __m128i r1_3 = state3_1;
 
   __m128i r2_0 = state0;
   __m128i r2_1 = state1;
   __m128i r2_2 = state2;
-  __m128i r2_3 = _mm_add_epi64(r0_3, _mm_set_epi32(0, 0, 0, 2));
+  __m128i r2_3 = state3_2;
 
   __m128i r3_0 = state0;
   __m128i r3_1 = state1;
   __m128i r3_2 = state2;
-  __m128i r3_3 = _mm_add_epi64(r0_3, _mm_set_epi32(0, 0, 0, 3));
+  __m128i r3_3 = state3_3;
 
-  for (int i = static_cast<int>(rounds); i > 0; i -= 2)
+  for (int i = ROUNDS ? int (ROUNDS) : static_cast<int>(rounds); i > 0; i -= 2)
     {
       r0_0 = _mm_add_epi32(r0_0, r0_1);
       r1_0 = _mm_add_epi32(r1_0, r1_1);
@@ -396,20 +439,17 @@ sse_block (std::array<uint32_t, 16> &state, const uint8_t *input, uint8_t *outpu
   r1_0 = _mm_add_epi32(r1_0, state0);
   r1_1 = _mm_add_epi32(r1_1, state1);
   r1_2 = _mm_add_epi32(r1_2, state2);
-  r1_3 = _mm_add_epi32(r1_3, state3);
-  r1_3 = _mm_add_epi64(r1_3, _mm_set_epi32(0, 0, 0, 1));
+  r1_3 = _mm_add_epi32(r1_3, state3_1);
 
   r2_0 = _mm_add_epi32(r2_0, state0);
   r2_1 = _mm_add_epi32(r2_1, state1);
   r2_2 = _mm_add_epi32(r2_2, state2);
-  r2_3 = _mm_add_epi32(r2_3, state3);
-  r2_3 = _mm_add_epi64(r2_3, _mm_set_epi32(0, 0, 0, 2));
+  r2_3 = _mm_add_epi32(r2_3, state3_2);
 
   r3_0 = _mm_add_epi32(r3_0, state0);
   r3_1 = _mm_add_epi32(r3_1, state1);
   r3_2 = _mm_add_epi32(r3_2, state2);
-  r3_3 = _mm_add_epi32(r3_3, state3);
-  r3_3 = _mm_add_epi64(r3_3, _mm_set_epi32(0, 0, 0, 3));
+  r3_3 = _mm_add_epi32(r3_3, state3_3);
 
   if (input)
     {
@@ -464,9 +504,14 @@ sse_block (std::array<uint32_t, 16> &state, const uint8_t *input, uint8_t *outpu
   _mm_storeu_si128(reinterpret_cast<__m128i*>(output+15*16), r3_3);
 
   state[12] += 4;
-  if (state[12] == 0)
+  if (state[12] < 4)
     state[13] += 1; // add with carry
 }
+static void
+sse_block (std::array<uint32_t, 16> &state, const uint8_t *input, uint8_t *output, unsigned int rounds)
+{
+  dispatch_rounds (rounds, [&] (auto R) { sse_rounds<R> (state, input, output, rounds); });
+}
 static constexpr unsigned sse_blocks = 4;
 #else // !__SSE2__
 static void chacha_sse (std::array<uint32_t, 16>&, const uint8_t*, uint8_t*, unsigned int) { assert (!"reached"); }
@@ -502,10 +547,20 @@ inline __m256i RotateLeft<16>(const __m256i val)
                                        13,12,15,14, 9,8,11,10, 5,4,7,6, 1,0,3,2);
   return _mm256_shuffle_epi8(val, mask);
 }
+
+template<bool STREAM>
+inline void store256(__m256i *p, const __m256i val)
+{
+  if constexpr (STREAM)
+    _mm256_stream_si256(p, val); // non-temporal, bypasses the caches
+  else
+    _mm256_storeu_si256(p, val);
+}
 } // Avx2
 
-static void
-avx2_block(std::array<uint32_t, 16> &state, const uint8_t *input, uint8_t *output, unsigned int rounds)
+/// Generate 8 blocks, for STREAM `output` must be 32 byte aligned and is written with non-temporal stores.
+template<bool STREAM, unsigned ROUNDS> static void
+avx2_rounds (std::array<uint32_t, 16> &state, const uint8_t *input, uint8_t *output, unsigned int rounds)
 {
   using namespace Avx2;
   const __m256i state0 = _mm256_broadcastsi128_si256(
@@ -543,7 +598,7 @@ avx2_block(std::array<uint32_t, 16> &state, const uint8_t *input, uint8_t *outpu
   __m256i X3_2 = state2;
   __m256i X3_3 = _mm256_add_epi32(state3, CTR3);
 
-  for (int i = static_cast<int>(rounds); i > 0; i -= 2)
+  for (int i = ROUNDS ? int (ROUNDS) : static_cast<int>(rounds); i > 0; i -= 2)
     {
       X0_0 = _mm256_add_epi32(X0_0, X0_1);
       X1_0 = _mm256_add_epi32(X1_0, X1_1);
@@ -724,109 +779,109 @@ avx2_block(std::array<uint32_t, 16> &state, const uint8_t *input, uint8_t *outpu
 
   if (input)
     {
-      _mm256_storeu_si256(reinterpret_cast<__m256i*>(output+0*32),
+      store256<STREAM>(reinterpret_cast<__m256i*>(output+0*32),
                           _mm256_xor_si256(_mm256_permute2x128_si256(X0_0, X0_1, 1 + (3 << 4)),
                                            _mm256_loadu_si256(const_cast<const __m256i*>(reinterpret_cast<const __m256i*>(input+0*32)))));
-      _mm256_storeu_si256(reinterpret_cast<__m256i*>(output+1*32),
+      store256<STREAM>(reinterpret_cast<__m256i*>(output+1*32),
                           _mm256_xor_si256(_mm256_permute2x128_si256(X0_2, X0_3, 1 + (3 << 4)),
                                            _mm256_loadu_si256(const_cast<const __m256i*>(reinterpret_cast<const __m256i*>(input+1*32)))));
-      _mm256_storeu_si256(reinterpret_cast<__m256i*>(output+2*32),
+      store256<STREAM>(reinterpret_cast<__m256i*>(output+2*32),
                           _mm256_xor_si256(_mm256_permute2x128_si256(X1_0, X1_1, 1 + (3 << 4)),
                                            _mm256_loadu_si256(const_cast<const __m256i*>(reinterpret_cast<const __m256i*>(input+2*32)))));
-      _mm256_storeu_si256(reinterpret_cast<__m256i*>(output+3*32),
+      store256<STREAM>(reinterpret_cast<__m256i*>(output+3*32),
                           _mm256_xor_si256(_mm256_permute2x128_si256(X1_2, X1_3, 1 + (3 << 4)),
                                            _mm256_loadu_si256(const_cast<const __m256i*>(reinterpret_cast<const __m256i*>(input+3*32)))));
     }
   else
     {
-      _mm256_storeu_si256(reinterpret_cast<__m256i*>(output+0*32),
+      store256<STREAM>(reinterpret_cast<__m256i*>(output+0*32),
                           _mm256_permute2x128_si256(X0_0, X0_1, 1 + (3 << 4)));
-      _mm256_storeu_si256(reinterpret_cast<__m256i*>(output+1*32),
+      store256<STREAM>(reinterpret_cast<__m256i*>(output+1*32),
                           _mm256_permute2x128_si256(X0_2, X0_3, 1 + (3 << 4)));
-      _mm256_storeu_si256(reinterpret_cast<__m256i*>(output+2*32),
+      store256<STREAM>(reinterpret_cast<__m256i*>(output+2*32),
                           _mm256_permute2x128_si256(X1_0, X1_1, 1 + (3 << 4)));
-      _mm256_storeu_si256(reinterpret_cast<__m256i*>(output+3*32),
+      store256<STREAM>(reinterpret_cast<__m256i*>(output+3*32),
                           _mm256_permute2x128_si256(X1_2, X1_3, 1 + (3 << 4)));
     }
 
   if (input)
     {
-      _mm256_storeu_si256(reinterpret_cast<__m256i*>(output+4*32),
+      store256<STREAM>(reinterpret_cast<__m256i*>(output+4*32),
                           _mm256_xor_si256(_mm256_permute2x128_si256(X2_0, X2_1, 1 + (3 << 4)),
                                            _mm256_loadu_si256(const_cast<const __m256i*>(reinterpret_cast<const __m256i*>(input+4*32)))));
-      _mm256_storeu_si256(reinterpret_cast<__m256i*>(output+5*32),
+      store256<STREAM>(reinterpret_cast<__m256i*>(output+5*32),
                           _mm256_xor_si256(_mm256_permute2x128_si256(X2_2, X2_3, 1 + (3 << 4)),
                                            _mm256_loadu_si256(const_cast<const __m256i*>(reinterpret_cast<const __m256i*>(input+5*32)))));
-      _mm256_storeu_si256(reinterpret_cast<__m256i*>(output+6*32),
+      store256<STREAM>(reinterpret_cast<__m256i*>(output+6*32),
                           _mm256_xor_si256(_mm256_permute2x128_si256(X3_0, X3_1, 1 + (3 << 4)),
                                            _mm256_loadu_si256(const_cast<const __m256i*>(reinterpret_cast<const __m256i*>(input+6*32)))));
-      _mm256_storeu_si256(reinterpret_cast<__m256i*>(output+7*32),
+      store256<STREAM>(reinterpret_cast<__m256i*>(output+7*32),
                           _mm256_xor_si256(_mm256_permute2x128_si256(X3_2, X3_3, 1 + (3 << 4)),
                                            _mm256_loadu_si256(const_cast<const __m256i*>(reinterpret_cast<const __m256i*>(input+7*32)))));
     }
   else
     {
-      _mm256_storeu_si256(reinterpret_cast<__m256i*>(output+4*32),
+      store256<STREAM>(reinterpret_cast<__m256i*>(output+4*32),
                           _mm256_permute2x128_si256(X2_0, X2_1, 1 + (3 << 4)));
-      _mm256_storeu_si256(reinterpret_cast<__m256i*>(output+5*32),
+      store256<STREAM>(reinterpret_cast<__m256i*>(output+5*32),
                           _mm256_permute2x128_si256(X2_2, X2_3, 1 + (3 << 4)));
-      _mm256_storeu_si256(reinterpret_cast<__m256i*>(output+6*32),
+      store256<STREAM>(reinterpret_cast<__m256i*>(output+6*32),
                           _mm256_permute2x128_si256(X3_0, X3_1, 1 + (3 << 4)));
-      _mm256_storeu_si256(reinterpret_cast<__m256i*>(output+7*32),
+      store256<STREAM>(reinterpret_cast<__m256i*>(output+7*32),
                           _mm256_permute2x128_si256(X3_2, X3_3, 1 + (3 << 4)));
     }
 
   if (input)
     {
-      _mm256_storeu_si256(reinterpret_cast<__m256i*>(output+ 8*32),
+      store256<STREAM>(reinterpret_cast<__m256i*>(output+ 8*32),
                           _mm256_xor_si256(_mm256_permute2x128_si256(X0_0, X0_1, 0 + (2 << 4)),
                                            _mm256_loadu_si256(const_cast<const __m256i*>(reinterpret_cast<const __m256i*>(input+8*32)))));
-      _mm256_storeu_si256(reinterpret_cast<__m256i*>(output+ 9*32),
+      store256<STREAM>(reinterpret_cast<__m256i*>(output+ 9*32),
                           _mm256_xor_si256(_mm256_permute2x128_si256(X0_2, X0_3, 0 + (2 << 4)),
                                            _mm256_loadu_si256(const_cast<const __m256i*>(reinterpret_cast<const __m256i*>(input+9*32)))));
-      _mm256_storeu_si256(reinterpret_cast<__m256i*>(output+10*32),
+      store256<STREAM>(reinterpret_cast<__m256i*>(output+10*32),
                           _mm256_xor_si256(_mm256_permute2x128_si256(X1_0, X1_1, 0 + (2 << 4)),
                                            _mm256_loadu_si256(const_cast<const __m256i*>(reinterpret_cast<const __m256i*>(input+10*32)))));
-      _mm256_storeu_si256(reinterpret_cast<__m256i*>(output+11*32),
+      store256<STREAM>(reinterpret_cast<__m256i*>(output+11*32),
                           _mm256_xor_si256(_mm256_permute2x128_si256(X1_2, X1_3, 0 + (2 << 4)),
                                            _mm256_loadu_si256(const_cast<const __m256i*>(reinterpret_cast<const __m256i*>(input+11*32)))));
     }
   else
     {
-      _mm256_storeu_si256(reinterpret_cast<__m256i*>(output+ 8*32),
+      store256<STREAM>(reinterpret_cast<__m256i*>(output+ 8*32),
                           _mm256_permute2x128_si256(X0_0, X0_1, 0 + (2 << 4)));
-      _mm256_storeu_si256(reinterpret_cast<__m256i*>(output+ 9*32),
+      store256<STREAM>(reinterpret_cast<__m256i*>(output+ 9*32),
                           _mm256_permute2x128_si256(X0_2, X0_3, 0 + (2 << 4)));
-      _mm256_storeu_si256(reinterpret_cast<__m256i*>(output+10*32),
+      store256<STREAM>(reinterpret_cast<__m256i*>(output+10*32),
                           _mm256_permute2x128_si256(X1_0, X1_1, 0 + (2 << 4)));
-      _mm256_storeu_si256(reinterpret_cast<__m256i*>(output+11*32),
+      store256<STREAM>(reinterpret_cast<__m256i*>(output+11*32),
                           _mm256_permute2x128_si256(X1_2, X1_3, 0 + (2 << 4)));
     }
 
   if (input)
     {
-      _mm256_storeu_si256(reinterpret_cast<__m256i*>(output+12*32),
+      store256<STREAM>(reinterpret_cast<__m256i*>(output+12*32),
                           _mm256_xor_si256(_mm256_permute2x128_si256(X2_0, X2_1, 0 + (2 << 4)),
                                            _mm256_loadu_si256(const_cast<const __m256i*>(reinterpret_cast<const __m256i*>(input+12*32)))));
-      _mm256_storeu_si256(reinterpret_cast<__m256i*>(output+13*32),
+      store256<STREAM>(reinterpret_cast<__m256i*>(output+13*32),
                           _mm256_xor_si256(_mm256_permute2x128_si256(X2_2, X2_3, 0 + (2 << 4)),
                                            _mm256_loadu_si256(const_cast<const __m256i*>(reinterpret_cast<const __m256i*>(input+13*32)))));
-      _mm256_storeu_si256(reinterpret_cast<__m256i*>(output+14*32),
+      store256<STREAM>(reinterpret_cast<__m256i*>(output+14*32),
                           _mm256_xor_si256(_mm256_permute2x128_si256(X3_0, X3_1, 0 + (2 << 4)),
                                            _mm256_loadu_si256(const_cast<const __m256i*>(reinterpret_cast<const __m256i*>(input+14*32)))));
-      _mm256_storeu_si256(reinterpret_cast<__m256i*>(output+15*32),
+      store256<STREAM>(reinterpret_cast<__m256i*>(output+15*32),
                           _mm256_xor_si256(_mm256_permute2x128_si256(X3_2, X3_3, 0 + (2 << 4)),
                                            _mm256_loadu_si256(const_cast<const __m256i*>(reinterpret_cast<const __m256i*>(input+15*32)))));
     }
   else
     {
-      _mm256_storeu_si256(reinterpret_cast<__m256i*>(output+12*32),
+      store256<STREAM>(reinterpret_cast<__m256i*>(output+12*32),
                           _mm256_permute2x128_si256(X2_0, X2_1, 0 + (2 << 4)));
-      _mm256_storeu_si256(reinterpret_cast<__m256i*>(output+13*32),
+      store256<STREAM>(reinterpret_cast<__m256i*>(output+13*32),
                           _mm256_permute2x128_si256(X2_2, X2_3, 0 + (2 << 4)));
-      _mm256_storeu_si256(reinterpret_cast<__m256i*>(output+14*32),
+      store256<STREAM>(reinterpret_cast<__m256i*>(output+14*32),
                           _mm256_permute2x128_si256(X3_0, X3_1, 0 + (2 << 4)));
-      _mm256_storeu_si256(reinterpret_cast<__m256i*>(output+15*32),
+      store256<STREAM>(reinterpret_cast<__m256i*>(output+15*32),
                           _mm256_permute2x128_si256(X3_2, X3_3, 0 + (2 << 4)));
     }
 
@@ -834,21 +889,156 @@ avx2_block(std::array<uint32_t, 16> &state, const uint8_t *input, uint8_t *outpu
   _mm256_zeroupper();
 
   state[12] += 8;
-  if (state[12] == 0)
+  if (state[12] < 8)
     state[13] += 1; // add with carry
 }
+template<bool STREAM = false> static void
+avx2_block (std::array<uint32_t, 16> &state, const uint8_t *input, uint8_t *output, unsigned int rounds)
+{
+  dispatch_rounds (rounds, [&] (auto R) { avx2_rounds<STREAM, R> (state, input, output, rounds); });
+}
 static constexpr unsigned avx_blocks = 8;
 #else // !__AVX2__
 static void chacha_avx2 (std::array<uint32_t, 16>&, const uint8_t*, uint8_t*, unsigned int) { assert (!"reached"); }
 static constexpr unsigned avx_blocks = 0;
 #endif // !__AVX2__
 
-static constexpr unsigned chacha_max_blocks = std::max (1u, std::max (sse_blocks, avx_blocks));
+// == AVX-512 ==
+#if defined(__AVX512F__)
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ == 12
+// Silence GCC-12 false positives about _mm512_undefined_epi32(), see https://gcc.gnu.org/PR105593
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#endif
+namespace Avx512 {
+template<unsigned int R>
+inline __m512i RotateLeft(const __m512i val)
+{
+  return _mm512_rol_epi32(val, R); // native vprold, no shift/or or byte shuffle needed
+}
+
+inline void
+QuarterRound(__m512i &a, __m512i &b, __m512i &c, __m512i &d)
+{
+  a = _mm512_add_epi32(a, b); d = RotateLeft<16>(_mm512_xor_si512(d, a));
+  c = _mm512_add_epi32(c, d); b = RotateLeft<12>(_mm512_xor_si512(b, c));
+  a = _mm512_add_epi32(a, b); d = RotateLeft<8>(_mm512_xor_si512(d, a));
+  c = _mm512_add_epi32(c, d); b = RotateLeft<7>(_mm512_xor_si512(b, c));
+}
+
+/// Transpose 4 words of 16 blocks, so each 128 bit lane `L` of `x_j` holds the words of block `4 * L + j`.
+inline void
+Transpose4(__m512i &x0, __m512i &x1, __m512i &x2, __m512i &x3)
+{
+  const __m512i t0 = _mm512_unpacklo_epi32(x0, x1), t1 = _mm512_unpackhi_epi32(x0, x1);
+  const __m512i t2 = _mm512_unpacklo_epi32(x2, x3), t3 = _mm512_unpackhi_epi32(x2, x3);
+  x0 = _mm512_unpacklo_epi64(t0, t2);
+  x1 = _mm512_unpackhi_epi64(t0, t2);
+  x2 = _mm512_unpacklo_epi64(t1, t3);
+  x3 = _mm512_unpackhi_epi64(t1, t3);
+}
+
+/// Store blocks `j`, `4 + j`, `8 + j`, `12 + j` from the lane transposed words 0-3, 4-7, 8-11, 12-15.
+inline void
+StoreBlocks(const uint8_t *input, uint8_t *output, unsigned j, __m512i a, __m512i b, __m512i c, __m512i d)
+{
+  const __m512i g0 = _mm512_shuffle_i32x4(a, b, 0x44), g1 = _mm512_shuffle_i32x4(a, b, 0xEE);
+  const __m512i g2 = _mm512_shuffle_i32x4(c, d, 0x44), g3 = _mm512_shuffle_i32x4(c, d, 0xEE);
+  const __m512i blocks[4] = { _mm512_shuffle_i32x4(g0, g2, 0x88), _mm512_shuffle_i32x4(g0, g2, 0xDD),
+                              _mm512_shuffle_i32x4(g1, g3, 0x88), _mm512_shuffle_i32x4(g1, g3, 0xDD) };
+  for (unsigned l = 0; l < 4; l++) {
+    const size_t offset = (4 * l + j) * 64;
+    __m512i v = blocks[l];
+    if (input)
+      v = _mm512_xor_si512(v, _mm512_loadu_si512(input + offset));
+    _mm512_storeu_si512(output + offset, v);
+  }
+}
+} // Avx512
+
+/// Generate 16 blocks, each zmm register holds one state word of all blocks.
+template<unsigned ROUNDS> static void
+avx512_rounds (std::array<uint32_t, 16> &state, const uint8_t *input, uint8_t *output, unsigned int rounds)
+{
+  using namespace Avx512;
+  __m512i s[16];
+  for (unsigned i = 0; i < 16; i++)
+    s[i] = _mm512_set1_epi32(state[i]);
+  // per block counters, add with carry into word 13
+  const __m512i ctr = _mm512_add_epi32(s[12], _mm512_set_epi32(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0));
+  s[13] = _mm512_mask_add_epi32(s[13], _mm512_cmplt_epu32_mask(ctr, s[12]), s[13], _mm512_set1_epi32(1));
+  s[12] = ctr;
+
+  __m512i x0 = s[0],   x1 = s[1],   x2 = s[2],   x3 = s[3];
+  __m512i x4 = s[4],   x5 = s[5],   x6 = s[6],   x7 = s[7];
+  __m512i x8 = s[8],   x9 = s[9],   x10 = s[10], x11 = s[11];
+  __m512i x12 = s[12], x13 = s[13], x14 = s[14], x15 = s[15];
+
+  for (int i = ROUNDS ? int (ROUNDS) : static_cast<int>(rounds); i > 0; i -= 2)
+    {
+      QuarterRound(x0, x4,  x8, x12);
+      QuarterRound(x1, x5,  x9, x13);
+      QuarterRound(x2, x6, x10, x14);
+      QuarterRound(x3, x7, x11, x15);
+
+      QuarterRound(x0, x5, x10, x15);
+      QuarterRound(x1, x6, x11, x12);
+      QuarterRound(x2, x7,  x8, x13);
+      QuarterRound(x3, x4,  x9, x14);
+    }
+
+  x0 = _mm512_add_epi32(x0, s[0]);     x1 = _mm512_add_epi32(x1, s[1]);
+  x2 = _mm512_add_epi32(x2, s[2]);     x3 = _mm512_add_epi32(x3, s[3]);
+  x4 = _mm512_add_epi32(x4, s[4]);     x5 = _mm512_add_epi32(x5, s[5]);
+  x6 = _mm512_add_epi32(x6, s[6]);     x7 = _mm512_add_epi32(x7, s[7]);
+  x8 = _mm512_add_epi32(x8, s[8]);     x9 = _mm512_add_epi32(x9, s[9]);
+  x10 = _mm512_add_epi32(x10, s[10]);  x11 = _mm512_add_epi32(x11, s[11]);
+  x12 = _mm512_add_epi32(x12, s[12]);  x13 = _mm512_add_epi32(x13, s[13]);
+  x14 = _mm512_add_epi32(x14, s[14]);  x15 = _mm512_add_epi32(x15, s[15]);
+
+  Transpose4(x0, x1, x2, x3);
+  Transpose4(x4, x5, x6, x7);
+  Transpose4(x8, x9, x10, x11);
+  Transpose4(x12, x13, x14, x15);
+  StoreBlocks(input, output, 0, x0, x4, x8,  x12);
+  StoreBlocks(input, output, 1, x1, x5, x9,  x13);
+  StoreBlocks(input, output, 2, x2, x6, x10, x14);
+  StoreBlocks(input, output, 3, x3, x7, x11, x15);
+
+  _mm256_zeroupper();
+
+  state[12] += 16;
+  if (state[12] < 16)
+    state[13] += 1; // add with carry
+}
+static void
+avx512_block (std::array<uint32_t, 16> &state, const uint8_t *input, uint8_t *output, unsigned int rounds)
+{
+  dispatch_rounds (rounds, [&] (auto R) { avx512_rounds<R> (state, input, output, rounds); });
+}
+static constexpr unsigned avx512_blocks = 16;
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ == 12
+#pragma GCC diagnostic pop
+#endif
+#else // !__AVX512F__
+// Callers skip avx512_block() when avx512_blocks == 0, this only keeps their branches compiling.
+static void avx512_block (std::array<uint32_t, 16>&, const uint8_t*, uint8_t*, unsigned int) { __builtin_unreachable(); }
+static constexpr unsigned avx512_blocks = 0;
+#endif // !__AVX512F__
+
+static constexpr unsigned chacha_max_blocks = std::max (1u, std::max (sse_blocks, std::max (avx_blocks, avx512_blocks)));
 
 static size_t
 generate_blocks (std::array<uint32_t, 16> &state, size_t maxlength, const uint8_t *input, uint8_t *output, unsigned rounds, const unsigned kind)
 {
   const uint8_t *const bound = output + maxlength;
+  if (avx512_blocks && kind >= 8)
+    while (output + 64 * avx512_blocks < bound) {
+      avx512_block (state, input, output, rounds);
+      output += avx512_blocks * 64;
+      input = !input ? nullptr : input + avx512_blocks * 64;
+    }
   if (avx_blocks && kind >= 4)
     while (output + 64 * avx_blocks < bound) {
       avx2_block (state, input, output, rounds);
@@ -873,19 +1063,25 @@ static size_t
 encrypt (std::array<uint32_t, 16> &state, const size_t blocklength, const uint8_t *input, uint8_t *output, unsigned rounds)
 {
   const uint8_t *const bound = output + blocklength;
+  if (avx512_blocks)
+    while (output + 64 * avx512_blocks <= bound) {
+      avx512_block (state, input, output, rounds);
+      output += avx512_blocks * 64;
+      input = !input ? nullptr : input + avx512_blocks * 64;
+    }
   if (avx_blocks)
-    while (output + 64 * avx_blocks < bound) {
+    while (output + 64 * avx_blocks <= bound) {
       avx2_block (state, input, output, rounds);
       output += avx_blocks * 64;
       input = !input ? nullptr : input + avx_blocks * 64;
     }
   if (sse_blocks)
-    while (output + 64 * sse_blocks < bound) {
+    while (output + 64 * sse_blocks <= bound) {
       sse_block (state, input, output, rounds);
       output += sse_blocks * 64;
       input = !input ? nullptr : input + sse_blocks * 64;
     }
-  while (output + 64 < bound) {
+  while (output + 64 <= bound) {
     alu_block (state, input, output, rounds);
     output += 1 * 64;
     input = !input ? nullptr : input + 1 * 64;
@@ -901,6 +1097,1020 @@ encrypt (std::array<uint32_t, 16> &state, const size_t blocklength, const uint8_
   return blocklength;
 }
 
+/// Position the 64 bit block counter of a key_setup() state at `byte_offset`, returns the offset within that block.
+static unsigned
+seek (std::array<uint32_t, 16> &state, uint64_t byte_offset) noexcept
+{
+  const uint64_t block = byte_offset / 64;
+  state[12] = uint32_t (block);
+  state[13] = uint32_t (block >> 32);
+  return byte_offset % 64;
+}
+
+/** Encrypt or decrypt `length` bytes at byte `offset` of the key_setup() stream for `key` and `nonce`.
+ * An unaligned `offset` uses part of one extra block, `input` may be nullptr to output the keystream.
+ */
+static void
+encrypt_range (const std::array<uint8_t, 32> &key, uint64_t nonce, uint64_t offset, const uint8_t *input, uint8_t *output,
+               size_t length, unsigned rounds = 20)
+{
+  std::array<uint32_t, 16> state;
+  key_setup (state, 256, key, nonce);
+  const unsigned skip = seek (state, offset);
+  if (skip && length) {
+    std::array<uint8_t, 64> block;
+    alu_block (state, nullptr, block.data(), rounds);
+    const size_t n = std::min (length, size_t (64 - skip));
+    for (size_t i = 0; i < n; i++)
+      output[i] = block[skip + i] ^ (input ? input[i] : 0);
+    input = !input ? nullptr : input + n;
+    output += n;
+    length -= n;
+  }
+  if (length)
+    encrypt (state, length, input, output, rounds);
+}
+
+/** Like encrypt_range(), but split into `nthreads` block aligned counter ranges that are processed concurrently.
+ * The calling thread processes the last range, small inputs are not split.
+ */
+static void
+encrypt_parallel (const std::array<uint8_t, 32> &key, uint64_t nonce, uint64_t offset, const uint8_t *input, uint8_t *output,
+                  size_t length, unsigned nthreads, unsigned rounds = 20)
+{
+  constexpr size_t MIN_RANGE = 64 * 1024;
+  nthreads = std::max (1ul, std::min (size_t (nthreads), length / MIN_RANGE));
+  const size_t per = (length / nthreads + 63) & ~size_t (63);
+  // range boundaries relative to `output`, aligned to absolute block boundaries
+  auto boundary = [&] (size_t k) -> size_t {
+    if (k >= nthreads)
+      return length;
+    const uint64_t abs = (offset + k * per + 63) & ~uint64_t (63);
+    return std::min (size_t (abs - offset), length);
+  };
+  std::vector<std::thread> threads;
+  for (size_t k = 0; k < nthreads; k++) {
+    const size_t b = k ? boundary (k) : 0, e = boundary (k + 1);
+    auto work = [&key, nonce, offset, input, output, rounds, b, e] () {
+      encrypt_range (key, nonce, offset + b, input ? input + b : nullptr, output + b, e - b, rounds);
+    };
+    if (k + 1 < nthreads)
+      threads.emplace_back (work);
+    else
+      work();
+  }
+  for (auto &t : threads)
+    t.join();
+}
+
+/** Cipher context that keeps unused keystream bytes across update() calls.
+ * The output only depends on the total number of bytes processed, not on how the input is chunked.
+ * Keystream is buffered in units of the widest SIMD kernel, so short packets are not limited to
+ * alu_block() speed, and inputs of at least one buffer size go straight through encrypt().
+ */
+class Stream {
+  static constexpr size_t  KEYSTREAM = 64 * chacha_max_blocks;
+  std::array<uint32_t, 16> state_;
+  std::array<uint8_t, KEYSTREAM> keystream_;
+  size_t                   used_ = KEYSTREAM;  // bytes of keystream_ already consumed
+  unsigned                 rounds_;
+  void
+  refill () noexcept
+  {
+    encrypt (state_, KEYSTREAM, nullptr, keystream_.data(), rounds_);
+    used_ = 0;
+  }
+public:
+  /// Continue the stream of a key_setup() or rfc7539_setup() `state` at its current block.
+  explicit
+  Stream (const std::array<uint32_t, 16> &state, unsigned rounds = 20) noexcept :
+    state_ (state), rounds_ (rounds)
+  {}
+  /// Start the key_setup() stream for `key` and `nonce` at byte `offset`.
+  Stream (const std::array<uint8_t, 32> &key, uint64_t nonce, uint64_t offset = 0, unsigned rounds = 20) noexcept :
+    rounds_ (rounds)
+  {
+    key_setup (state_, 256, key, nonce);
+    const unsigned skip = seek (state_, offset);
+    if (skip) {
+      refill();
+      used_ = skip;
+    }
+  }
+  ~Stream()
+  {
+    secure_zero (state_.data(), sizeof (state_));
+    secure_zero (keystream_.data(), sizeof (keystream_));
+  }
+  /// Encrypt or decrypt `length` bytes, `input` may be nullptr to output the keystream.
+  void
+  update (const uint8_t *input, uint8_t *output, size_t length) noexcept
+  {
+    while (length) {
+      if (used_ == KEYSTREAM && length >= KEYSTREAM) {
+        const size_t bulk = length - length % KEYSTREAM;
+        encrypt (state_, bulk, input, output, rounds_);
+        input = !input ? nullptr : input + bulk;
+        output += bulk;
+        length -= bulk;
+        continue;
+      }
+      if (used_ == KEYSTREAM)
+        refill();
+      const size_t n = std::min (length, KEYSTREAM - used_);
+      const uint8_t *ks = &keystream_[used_];
+      if (input) {
+        size_t i = 0;
+        for (uint64_t w, k; i + 8 <= n; i += 8) {
+          memcpy (&w, input + i, 8);
+          memcpy (&k, ks + i, 8);
+          w ^= k;
+          memcpy (output + i, &w, 8);
+        }
+        for (; i < n; i++)
+          output[i] = ks[i] ^ input[i];
+      } else
+        memcpy (output, ks, n);
+      used_ += n;
+      input = !input ? nullptr : input + n;
+      output += n;
+      length -= n;
+    }
+  }
+  /// Current block state, i.e. the block following the buffered keystream.
+  const std::array<uint32_t, 16>& state () const noexcept { return state_; }
+};
+
+/** Buffered ChaCha CSPRNG with fast key erasure, see https://blog.cr.yp.to/20170723-random.html
+ * Each refill generates BUFFER bytes with the widest kernel, the first 32 bytes immediately replace the key
+ * and are wiped, and every byte handed out is wiped from the buffer. So a later compromise of the object
+ * reveals neither past outputs nor the keys they were generated from.
+ * Satisfies UniformRandomBitGenerator, e.g. for std::uniform_int_distribution.
+ */
+class Rng {
+  static constexpr size_t  BUFFER = 4 * 64 * chacha_max_blocks;
+  alignas (64) std::array<uint8_t, BUFFER> buffer_;
+  std::array<uint32_t, 16> state_;
+  size_t                   pos_ = BUFFER;    // next unread byte of buffer_
+  unsigned                 rounds_;
+  void
+  rekey (const std::array<uint8_t, 32> &key) noexcept
+  {
+    key_setup (state_, 256, key, 0);
+  }
+  void
+  refill () noexcept
+  {
+    encrypt (state_, BUFFER, nullptr, buffer_.data(), rounds_);
+    std::array<uint8_t, 32> key;
+    memcpy (key.data(), buffer_.data(), 32);
+    rekey (key);
+    secure_zero (key.data(), 32);
+    secure_zero (buffer_.data(), 32);
+    pos_ = 32;
+  }
+public:
+  using result_type = uint64_t;
+  static constexpr result_type min () { return 0; }
+  static constexpr result_type max () { return ~result_type (0); }
+  explicit
+  Rng (const std::array<uint8_t, 32> &seed, unsigned rounds = 20) noexcept :
+    rounds_ (rounds)
+  {
+    rekey (seed);
+  }
+  ~Rng()
+  {
+    secure_zero (state_.data(), sizeof (state_));
+    secure_zero (buffer_.data(), sizeof (buffer_));
+  }
+  Rng (const Rng&) = delete;
+  Rng& operator= (const Rng&) = delete;
+  /// Mix `seed` into the key, the current key contributes as well so reseeding never loses entropy.
+  void
+  reseed (const std::array<uint8_t, 32> &seed) noexcept
+  {
+    std::array<uint8_t, 32> key;
+    fill (key.data(), key.size());
+    for (size_t i = 0; i < 32; i++)
+      key[i] ^= seed[i];
+    rekey (key);
+    secure_zero (key.data(), 32);
+    secure_zero (buffer_.data(), sizeof (buffer_));
+    pos_ = BUFFER;
+  }
+  /// Copy `length` random bytes to `output`.
+  void
+  fill (uint8_t *output, size_t length) noexcept
+  {
+    while (length) {
+      if (pos_ == BUFFER)
+        refill();
+      const size_t n = std::min (length, BUFFER - pos_);
+      memcpy (output, &buffer_[pos_], n);
+      memset (&buffer_[pos_], 0, n);
+      pos_ += n;
+      output += n;
+      length -= n;
+    }
+  }
+  /// Next 64 bit random number, the same bytes fill() would produce in little endian order.
+  uint64_t
+  next64 () noexcept
+  {
+    if (pos_ + 8 > BUFFER) {
+      uint8_t bytes[8];
+      fill (bytes, 8);
+      return Alu::load32 (bytes) | uint64_t (Alu::load32 (bytes + 4)) << 32;
+    }
+    const uint8_t *p = &buffer_[pos_];
+    const uint64_t v = Alu::load32 (p) | uint64_t (Alu::load32 (p + 4)) << 32;
+    memset (&buffer_[pos_], 0, 8);
+    pos_ += 8;
+    return v;
+  }
+  result_type operator() () noexcept { return next64(); }
+};
+
+/** Keystream ring that a background thread keeps topped up with ChaCha::Rng output, so draws never
+ * wait for a refill. Single producer, single consumer: fill() and next64() must be called from one
+ * thread at a time. A draw copies from the ring, wipes the copied bytes and publishes them as free
+ * with one atomic store of the read index. Once the ring is full the producer sleeps until the fill
+ * level drops below LOW_WATERMARK, then refills it completely. If a draw finds too few bytes it is
+ * served inline from a second Rng with an independent key instead of blocking.
+ */
+class RngRing {
+  static constexpr size_t  CAPACITY = 64 * 1024, CHUNK = 4096, LOW_WATERMARK = CAPACITY / 2;
+  static_assert (CAPACITY % CHUNK == 0, "chunks must not wrap around the ring");
+  alignas (64) std::array<uint8_t, CAPACITY> ring_;
+  alignas (64) std::atomic<uint64_t> head_ { 0 };   // bytes produced, written by the producer
+  alignas (64) std::atomic<uint64_t> tail_ { 0 };   // bytes consumed, written by the consumer
+  alignas (64) std::atomic<bool>     quit_ { false };
+  std::mutex                mutex_;
+  std::condition_variable   cond_;
+  std::unique_ptr<Rng>      producer_rng_, fallback_;
+  std::thread               thread_;
+  uint64_t                  inline_bytes_ = 0;
+  void
+  produce () noexcept
+  {
+    while (!quit_.load (std::memory_order_relaxed)) {
+      const uint64_t head = head_.load (std::memory_order_relaxed);
+      if (head - tail_.load (std::memory_order_acquire) + CHUNK <= CAPACITY) {
+        producer_rng_->fill (&ring_[head % CAPACITY], CHUNK);
+        head_.store (head + CHUNK, std::memory_order_release);
+        continue;
+      }
+      // full, consumers notify when crossing the watermark, the timeout covers a missed notification
+      std::unique_lock<std::mutex> lock (mutex_);
+      cond_.wait_for (lock, std::chrono::milliseconds (1), [this] () {
+        return quit_.load (std::memory_order_relaxed) || available() < LOW_WATERMARK;
+      });
+    }
+  }
+public:
+  explicit
+  RngRing (const std::array<uint8_t, 32> &seed, unsigned rounds = 20)
+  {
+    Rng seeder (seed, rounds);
+    std::array<uint8_t, 32> key;
+    seeder.fill (key.data(), key.size());
+    producer_rng_ = std::make_unique<Rng> (key, rounds);
+    seeder.fill (key.data(), key.size());
+    fallback_ = std::make_unique<Rng> (key, rounds);
+    secure_zero (key.data(), key.size());
+    thread_ = std::thread ([this] () { produce(); });
+  }
+  ~RngRing()
+  {
+    quit_.store (true);
+    cond_.notify_one();
+    thread_.join();
+    secure_zero (ring_.data(), sizeof (ring_));
+  }
+  RngRing (const RngRing&) = delete;
+  RngRing& operator= (const RngRing&) = delete;
+  /// Copy `length` random bytes to `output`.
+  void
+  fill (uint8_t *output, size_t length) noexcept
+  {
+    const uint64_t tail = tail_.load (std::memory_order_relaxed);
+    const size_t available = head_.load (std::memory_order_acquire) - tail;
+    if (length > available) {
+      inline_bytes_ += length;
+      fallback_->fill (output, length);
+      cond_.notify_one();
+      return;
+    }
+    const size_t pos = tail % CAPACITY, n = std::min (length, CAPACITY - pos);
+    memcpy (output, &ring_[pos], n);
+    memcpy (output + n, &ring_[0], length - n);
+    memset (&ring_[pos], 0, n);
+    memset (&ring_[0], 0, length - n);
+    tail_.store (tail + length, std::memory_order_release);
+    if (available >= LOW_WATERMARK && available - length < LOW_WATERMARK)
+      cond_.notify_one();
+  }
+  /// Next 64 bit random number.
+  uint64_t
+  next64 () noexcept
+  {
+    uint8_t bytes[8];
+    fill (bytes, 8);
+    return Alu::load32 (bytes) | uint64_t (Alu::load32 (bytes + 4)) << 32;
+  }
+  /// Number of bytes ready in the ring.
+  size_t
+  available () const noexcept
+  {
+    return head_.load (std::memory_order_acquire) - tail_.load (std::memory_order_acquire);
+  }
+  /// Number of bytes that had to be generated inline because the ring ran dry.
+  uint64_t inline_bytes () const noexcept { return inline_bytes_; }
+};
+
+#if defined(__AVX2__)
+/// Copy `n` bytes with non-temporal stores for all 32 byte aligned parts of `dst`.
+static void
+stream_copy (uint8_t *dst, const uint8_t *src, size_t n)
+{
+  const size_t head = std::min (n, (32 - (uintptr_t (dst) & 31)) & 31);
+  memcpy (dst, src, head);
+  size_t i;
+  for (i = head; i + 32 <= n; i += 32)
+    _mm256_stream_si256 (reinterpret_cast<__m256i*> (dst + i), _mm256_loadu_si256 (reinterpret_cast<const __m256i*> (src + i)));
+  memcpy (dst + i, src + i, n - i);
+}
+
+/** Generate `length` bytes of keystream like generate_blocks(), but with non-temporal stores.
+ * Large fills then do not evict the working set of consumers from the last level cache.
+ * An unaligned `output` is filled via an L1 resident bounce buffer with non-temporal copies,
+ * cached stores are only used for its head and tail. `length` must be a multiple of 64.
+ */
+static size_t
+generate_blocks_stream (std::array<uint32_t, 16> &state, const size_t length, uint8_t *output, unsigned rounds)
+{
+  assert (length % 64 == 0);
+  uint8_t *const bound = output + length;
+  if (0 == (uintptr_t (output) & 31))
+    while (output + 64 * avx_blocks <= bound) {
+      avx2_block<true> (state, nullptr, output, rounds);
+      output += 64 * avx_blocks;
+    }
+  alignas (32) uint8_t bounce[8 * 64 * avx_blocks];
+  while (output < bound) {
+    const size_t n = std::min (size_t (bound - output), sizeof (bounce));
+    size_t i;
+    for (i = 0; i + 64 * avx_blocks <= n; i += 64 * avx_blocks)
+      avx2_block (state, nullptr, bounce + i, rounds);
+    for (; i < n; i += 64)
+      alu_block (state, nullptr, bounce + i, rounds);
+    stream_copy (output, bounce, n);
+    output += n;
+  }
+  _mm_sfence(); // order the weakly ordered stores before later stores
+  return length;
+}
+#endif // __AVX2__
+
+// == HChaCha20 / XChaCha20 ==
+// https://datatracker.ietf.org/doc/html/draft-irtf-cfrg-xchacha
+
+/// Derive a 256 bit subkey from `key` and the first 128 bits of an extended nonce.
+static void
+hchacha20 (std::array<uint8_t, 32> &subkey, const std::array<uint8_t, 32> &key, const uint8_t nonce[16]) noexcept
+{
+  using namespace Alu;
+  std::array<uint32_t, 16> x;
+  memcpy (&x[0], "expand 32-byte k", 16);
+  memcpy (&x[4], &key[0], 32);
+  for (unsigned i = 0; i < 4; i++)
+    x[12 + i] = load32 (&nonce[4 * i]);
+  for (int i = 20; i > 0; i -= 2)
+    {
+      qround32 (x[0], x[4],  x[8], x[12]);
+      qround32 (x[1], x[5],  x[9], x[13]);
+      qround32 (x[2], x[6], x[10], x[14]);
+      qround32 (x[3], x[7], x[11], x[15]);
+
+      qround32 (x[0], x[5], x[10], x[15]);
+      qround32 (x[1], x[6], x[11], x[12]);
+      qround32 (x[2], x[7],  x[8], x[13]);
+      qround32 (x[3], x[4],  x[9], x[14]);
+    }
+  // no feed forward, the output words are the first and last row
+  for (unsigned i = 0; i < 4; i++) {
+    store32 (&subkey[4 * i], x[i]);
+    store32 (&subkey[16 + 4 * i], x[12 + i]);
+  }
+  secure_zero (x.data(), sizeof (x));
+}
+
+/// XChaCha20 setup with 192 bit nonce, ChaCha20 with the HChaCha20 subkey and the last 64 nonce bits.
+static void
+xchacha20_setup (std::array<uint32_t, 16> &state, const std::array<uint8_t, 32> &key,
+                 const std::array<uint8_t, 24> &nonce, uint32_t counter = 0) noexcept
+{
+  std::array<uint8_t, 32> subkey;
+  hchacha20 (subkey, key, &nonce[0]);
+  std::array<uint8_t, 12> inner { 0, 0, 0, 0 };
+  memcpy (&inner[4], &nonce[16], 8);
+  rfc7539_setup (state, subkey, inner, counter);
+  secure_zero (subkey.data(), subkey.size());
+}
+
+#if defined(__SSE2__)
+static inline void
+vquarter_round (__m128i &a, __m128i &b, __m128i &c, __m128i &d)
+{
+  using namespace Sse2;
+  a = _mm_add_epi32(a, b); d = RotateLeft<16>(_mm_xor_si128(d, a));
+  c = _mm_add_epi32(c, d); b = RotateLeft<12>(_mm_xor_si128(b, c));
+  a = _mm_add_epi32(a, b); d = RotateLeft<8>(_mm_xor_si128(d, a));
+  c = _mm_add_epi32(c, d); b = RotateLeft<7>(_mm_xor_si128(b, c));
+}
+#endif // __SSE2__
+#if defined(__AVX2__)
+static inline void
+vquarter_round (__m256i &a, __m256i &b, __m256i &c, __m256i &d)
+{
+  using namespace Avx2;
+  a = _mm256_add_epi32(a, b); d = RotateLeft<16>(_mm256_xor_si256(d, a));
+  c = _mm256_add_epi32(c, d); b = RotateLeft<12>(_mm256_xor_si256(b, c));
+  a = _mm256_add_epi32(a, b); d = RotateLeft<8>(_mm256_xor_si256(d, a));
+  c = _mm256_add_epi32(c, d); b = RotateLeft<7>(_mm256_xor_si256(b, c));
+}
+#endif // __AVX2__
+#if defined(__AVX512F__)
+static inline void
+vquarter_round (__m512i &a, __m512i &b, __m512i &c, __m512i &d)
+{
+  Avx512::QuarterRound (a, b, c, d);
+}
+#endif // __AVX512F__
+
+/// HChaCha20 for one vector width of nonces, each 32 bit lane of a register holds the same word of another nonce.
+template<class V> static void
+hchacha20_lanes (std::array<uint8_t, 32> *subkeys, const std::array<uint8_t, 32> &key, const std::array<uint8_t, 16> *nonces)
+{
+  using namespace Alu;
+  constexpr unsigned LANES = sizeof (V) / 4;
+  alignas (64) uint32_t w[16][LANES];
+  uint32_t row[12];
+  memcpy (&row[0], "expand 32-byte k", 16);
+  memcpy (&row[4], &key[0], 32);
+  for (unsigned i = 0; i < 12; i++)
+    for (unsigned l = 0; l < LANES; l++)
+      w[i][l] = row[i];
+  for (unsigned i = 0; i < 4; i++)
+    for (unsigned l = 0; l < LANES; l++)
+      w[12 + i][l] = load32 (&nonces[l][4 * i]);
+  V x[16];
+  memcpy (x, w, sizeof (x));
+  for (int i = 20; i > 0; i -= 2)
+    {
+      vquarter_round (x[0], x[4],  x[8], x[12]);
+      vquarter_round (x[1], x[5],  x[9], x[13]);
+      vquarter_round (x[2], x[6], x[10], x[14]);
+      vquarter_round (x[3], x[7], x[11], x[15]);
+
+      vquarter_round (x[0], x[5], x[10], x[15]);
+      vquarter_round (x[1], x[6], x[11], x[12]);
+      vquarter_round (x[2], x[7],  x[8], x[13]);
+      vquarter_round (x[3], x[4],  x[9], x[14]);
+    }
+  memcpy (w, x, sizeof (x));
+  for (unsigned l = 0; l < LANES; l++)
+    for (unsigned i = 0; i < 4; i++) {
+      store32 (&subkeys[l][4 * i], w[i][l]);
+      store32 (&subkeys[l][16 + 4 * i], w[12 + i][l]);
+    }
+  secure_zero (row, sizeof (row));
+  secure_zero (w, sizeof (w));
+  secure_zero (x, sizeof (x));
+}
+
+/// Derive `n` subkeys for many records at once, runs 16, 8 or 4 nonces in parallel with AVX-512, AVX2 or SSE2.
+static void
+hchacha20_batch (std::array<uint8_t, 32> *subkeys, const std::array<uint8_t, 32> &key, const std::array<uint8_t, 16> *nonces, size_t n)
+{
+  size_t i = 0;
+#if defined(__AVX512F__)
+  for (; i + 16 <= n; i += 16)
+    hchacha20_lanes<__m512i> (subkeys + i, key, nonces + i);
+#endif
+#if defined(__AVX2__)
+  for (; i + 8 <= n; i += 8)
+    hchacha20_lanes<__m256i> (subkeys + i, key, nonces + i);
+#endif
+#if defined(__SSE2__)
+  for (; i + 4 <= n; i += 4)
+    hchacha20_lanes<__m128i> (subkeys + i, key, nonces + i);
+#endif
+  // scalar tail, counted from 0 so the trip count stays below the vector width
+  const size_t rest = n - i;
+  for (size_t j = 0; j < rest; j++)
+    hchacha20 (subkeys[i + j], key, nonces[i + j].data());
+}
+
+/// XChaCha20 setup for `n` records, the subkeys are derived with hchacha20_batch().
+static void
+xchacha20_setup_batch (std::array<uint32_t, 16> *states, const std::array<uint8_t, 32> &key,
+                       const std::array<uint8_t, 24> *nonces, size_t n, uint32_t counter = 0)
+{
+  constexpr size_t BATCH = 64;
+  std::array<uint8_t, 16> prefixes[BATCH];
+  std::array<uint8_t, 32> subkeys[BATCH];
+  for (size_t i = 0; i < n; i += BATCH) {
+    const size_t m = std::min (BATCH, n - i);
+    for (size_t j = 0; j < m; j++)
+      memcpy (prefixes[j].data(), nonces[i + j].data(), 16);
+    hchacha20_batch (subkeys, key, prefixes, m);
+    for (size_t j = 0; j < m; j++) {
+      std::array<uint8_t, 12> inner { 0, 0, 0, 0 };
+      memcpy (&inner[4], &nonces[i + j][16], 8);
+      rfc7539_setup (states[i + j], subkeys[j], inner, counter);
+    }
+  }
+  secure_zero (subkeys, sizeof (subkeys));
+}
+
+// == Multi-key batches ==
+/// One message of an encrypt_many() batch, `input` may be nullptr to output keystream.
+struct Message {
+  std::array<uint32_t, 16> *state;      ///< key_setup() or rfc7539_setup() state, advanced like encrypt() does
+  const uint8_t            *input;
+  uint8_t                  *output;
+  size_t                    length;
+};
+
+/// Encrypt one message per 32 bit lane, each lane holds the same state word of another message.
+template<class V> static void
+encrypt_lanes (Message *messages, unsigned rounds)
+{
+  using namespace Alu;
+  constexpr unsigned LANES = sizeof (V) / 4;
+  alignas (64) uint32_t w[16][LANES], ks[16][LANES];
+  size_t nblocks[LANES], maxblocks = 0;
+  for (unsigned l = 0; l < LANES; l++) {
+    const std::array<uint32_t, 16> &state = *messages[l].state;
+    for (unsigned i = 0; i < 16; i++)
+      w[i][l] = state[i];
+    nblocks[l] = (messages[l].length + 63) / 64;
+    maxblocks = std::max (maxblocks, nblocks[l]);
+  }
+  for (size_t b = 0; b < maxblocks; b++) {
+    V x[16];
+    memcpy (x, w, sizeof (x));
+    for (int i = rounds; i > 0; i -= 2)
+      {
+        vquarter_round (x[0], x[4],  x[8], x[12]);
+        vquarter_round (x[1], x[5],  x[9], x[13]);
+        vquarter_round (x[2], x[6], x[10], x[14]);
+        vquarter_round (x[3], x[7], x[11], x[15]);
+
+        vquarter_round (x[0], x[5], x[10], x[15]);
+        vquarter_round (x[1], x[6], x[11], x[12]);
+        vquarter_round (x[2], x[7],  x[8], x[13]);
+        vquarter_round (x[3], x[4],  x[9], x[14]);
+      }
+    memcpy (ks, x, sizeof (ks));
+    for (unsigned l = 0; l < LANES; l++) {
+      if (b >= nblocks[l])
+        continue;
+      const Message &m = messages[l];
+      const size_t pos = b * 64, n = std::min (size_t (64), m.length - pos);
+      if (n == 64) {
+        if (m.input)
+          for (unsigned i = 0; i < 16; i++)
+            store32 (&m.output[pos + 4 * i], (ks[i][l] + w[i][l]) ^ load32 (&m.input[pos + 4 * i]));
+        else
+          for (unsigned i = 0; i < 16; i++)
+            store32 (&m.output[pos + 4 * i], ks[i][l] + w[i][l]);
+      } else {
+        uint8_t block[64];
+        for (unsigned i = 0; i < 16; i++)
+          store32 (&block[4 * i], ks[i][l] + w[i][l]);
+        for (size_t i = 0; i < n; i++)
+          m.output[pos + i] = block[i] ^ (m.input ? m.input[pos + i] : 0);
+        secure_zero (block, sizeof (block));
+      }
+      if (++w[12][l] == 0)
+        w[13][l]++;
+    }
+  }
+  for (unsigned l = 0; l < LANES; l++) {
+    (*messages[l].state)[12] = w[12][l];
+    (*messages[l].state)[13] = w[13][l];
+  }
+  secure_zero (w, sizeof (w));
+  secure_zero (ks, sizeof (ks));
+}
+
+/** Encrypt or decrypt `n` independent messages, e.g. many short packets under different keys.
+ * Runs 16, 8 or 4 messages in parallel with AVX-512, AVX2 or SSE2, unlike encrypt() which
+ * needs several consecutive blocks of one key to use SIMD. A batch runs as long as its longest
+ * message, so messages of similar length should be adjacent.
+ */
+static void
+encrypt_many (Message *messages, size_t n, unsigned rounds = 20)
+{
+  size_t i = 0;
+#if defined(__AVX512F__)
+  for (; i + 16 <= n; i += 16)
+    encrypt_lanes<__m512i> (messages + i, rounds);
+#endif
+#if defined(__AVX2__)
+  for (; i + 8 <= n; i += 8)
+    encrypt_lanes<__m256i> (messages + i, rounds);
+#endif
+#if defined(__SSE2__)
+  for (; i + 4 <= n; i += 4)
+    encrypt_lanes<__m128i> (messages + i, rounds);
+#endif
+  for (; i < n; i++)
+    if (messages[i].length)
+      encrypt (*messages[i].state, messages[i].length, messages[i].input, messages[i].output, rounds);
+}
+
+// == Poly1305 ==
+// Based on the 32 bit variant of https://github.com/floodyberry/poly1305-donna
+// The accumulator is kept in 26 bit limbs, so the scalar, SSE2 and AVX2 paths share one representation.
+namespace Poly {
+static constexpr uint32_t LIMB_MASK = 0x3ffffff;
+
+/// Load a 16 byte block into 26 bit limbs, `hibit` is `1 << 24` for full blocks.
+static inline void
+load_limbs (uint32_t m[5], const uint8_t *b, uint32_t hibit) noexcept
+{
+  m[0] = (Alu::load32 (b +  0) >> 0) & LIMB_MASK;
+  m[1] = (Alu::load32 (b +  3) >> 2) & LIMB_MASK;
+  m[2] = (Alu::load32 (b +  6) >> 4) & LIMB_MASK;
+  m[3] = (Alu::load32 (b +  9) >> 6) & LIMB_MASK;
+  m[4] = (Alu::load32 (b + 12) >> 8) | hibit;
+}
+
+/// Compute `h = h * r mod 2^130-5` with partial reduction, the limbs of `h` stay below 2^27.
+static inline void
+mul_limbs (uint32_t h[5], const uint32_t r[5]) noexcept
+{
+  const uint32_t s1 = r[1] * 5, s2 = r[2] * 5, s3 = r[3] * 5, s4 = r[4] * 5;
+  const uint64_t d0 = uint64_t (h[0]) * r[0] + uint64_t (h[1]) * s4 + uint64_t (h[2]) * s3 + uint64_t (h[3]) * s2 + uint64_t (h[4]) * s1;
+  uint64_t d1 = uint64_t (h[0]) * r[1] + uint64_t (h[1]) * r[0] + uint64_t (h[2]) * s4 + uint64_t (h[3]) * s3 + uint64_t (h[4]) * s2;
+  uint64_t d2 = uint64_t (h[0]) * r[2] + uint64_t (h[1]) * r[1] + uint64_t (h[2]) * r[0] + uint64_t (h[3]) * s4 + uint64_t (h[4]) * s3;
+  uint64_t d3 = uint64_t (h[0]) * r[3] + uint64_t (h[1]) * r[2] + uint64_t (h[2]) * r[1] + uint64_t (h[3]) * r[0] + uint64_t (h[4]) * s4;
+  uint64_t d4 = uint64_t (h[0]) * r[4] + uint64_t (h[1]) * r[3] + uint64_t (h[2]) * r[2] + uint64_t (h[3]) * r[1] + uint64_t (h[4]) * r[0];
+  uint32_t c;
+  c = d0 >> 26; h[0] = d0 & LIMB_MASK;
+  d1 += c;      c = d1 >> 26; h[1] = d1 & LIMB_MASK;
+  d2 += c;      c = d2 >> 26; h[2] = d2 & LIMB_MASK;
+  d3 += c;      c = d3 >> 26; h[3] = d3 & LIMB_MASK;
+  d4 += c;      c = d4 >> 26; h[4] = d4 & LIMB_MASK;
+  h[0] += c * 5; c = h[0] >> 26; h[0] &= LIMB_MASK;
+  h[1] += c;
+}
+
+/** Process `nchunks` of `Ops::LANES` blocks each, with one accumulator per lane.
+ * Every chunk is added to the lane accumulators which are then multiplied by `r^LANES`,
+ * except after the last chunk where each lane is multiplied by the power of `r` that
+ * matches its block position. The lane sum is the same as `LANES * nchunks` scalar steps.
+ * `pow[k]` holds `r^(k+1)`.
+ */
+template<class Ops> static void
+blocks_simd (uint32_t h[5], const uint32_t pow[4][5], const uint8_t *m, size_t nchunks)
+{
+  using V = typename Ops::V;
+  const V mask = Ops::set1 (LIMB_MASK), hibit = Ops::set1 (1 << 24);
+  V rn[5], sn[5], rl[5], sl[5], x[5];
+  for (unsigned i = 0; i < 5; i++) {
+    rn[i] = Ops::set1 (pow[Ops::LANES - 1][i]);
+    sn[i] = Ops::set1 (pow[Ops::LANES - 1][i] * 5);
+    rl[i] = Ops::lane_powers (pow, i, 1);
+    sl[i] = Ops::lane_powers (pow, i, 5);
+    x[i] = Ops::set_first (h[i]);
+  }
+  auto mul = [&mask] (V x[5], const V r[5], const V s[5]) {
+    const V d0 = Ops::add (Ops::add (Ops::add (Ops::mul (x[0], r[0]), Ops::mul (x[1], s[4])), Ops::add (Ops::mul (x[2], s[3]), Ops::mul (x[3], s[2]))), Ops::mul (x[4], s[1]));
+    V d1 = Ops::add (Ops::add (Ops::add (Ops::mul (x[0], r[1]), Ops::mul (x[1], r[0])), Ops::add (Ops::mul (x[2], s[4]), Ops::mul (x[3], s[3]))), Ops::mul (x[4], s[2]));
+    V d2 = Ops::add (Ops::add (Ops::add (Ops::mul (x[0], r[2]), Ops::mul (x[1], r[1])), Ops::add (Ops::mul (x[2], r[0]), Ops::mul (x[3], s[4]))), Ops::mul (x[4], s[3]));
+    V d3 = Ops::add (Ops::add (Ops::add (Ops::mul (x[0], r[3]), Ops::mul (x[1], r[2])), Ops::add (Ops::mul (x[2], r[1]), Ops::mul (x[3], r[0]))), Ops::mul (x[4], s[4]));
+    V d4 = Ops::add (Ops::add (Ops::add (Ops::mul (x[0], r[4]), Ops::mul (x[1], r[3])), Ops::add (Ops::mul (x[2], r[2]), Ops::mul (x[3], r[1]))), Ops::mul (x[4], r[0]));
+    V c;
+    c = Ops::template srli<26> (d0); x[0] = Ops::band (d0, mask);
+    d1 = Ops::add (d1, c); c = Ops::template srli<26> (d1); x[1] = Ops::band (d1, mask);
+    d2 = Ops::add (d2, c); c = Ops::template srli<26> (d2); x[2] = Ops::band (d2, mask);
+    d3 = Ops::add (d3, c); c = Ops::template srli<26> (d3); x[3] = Ops::band (d3, mask);
+    d4 = Ops::add (d4, c); c = Ops::template srli<26> (d4); x[4] = Ops::band (d4, mask);
+    x[0] = Ops::add (x[0], Ops::add (c, Ops::template slli<2> (c))); // c * 5
+    c = Ops::template srli<26> (x[0]); x[0] = Ops::band (x[0], mask);
+    x[1] = Ops::add (x[1], c);
+  };
+  for (size_t k = 0; k < nchunks; k++, m += 16 * Ops::LANES) {
+    V lo, hi;
+    Ops::load (m, lo, hi);
+    x[0] = Ops::add (x[0], Ops::band (lo, mask));
+    x[1] = Ops::add (x[1], Ops::band (Ops::template srli<26> (lo), mask));
+    x[2] = Ops::add (x[2], Ops::band (Ops::bor (Ops::template srli<52> (lo), Ops::template slli<12> (hi)), mask));
+    x[3] = Ops::add (x[3], Ops::band (Ops::template srli<14> (hi), mask));
+    x[4] = Ops::add (x[4], Ops::bor (Ops::template srli<40> (hi), hibit));
+    if (k + 1 < nchunks)
+      mul (x, rn, sn);
+  }
+  mul (x, rl, sl);
+  uint64_t d[5] = { 0, 0, 0, 0, 0 };
+  for (unsigned i = 0; i < 5; i++) {
+    alignas (32) uint64_t lanes[Ops::LANES];
+    Ops::store (lanes, x[i]);
+    for (unsigned l = 0; l < Ops::LANES; l++)
+      d[i] += lanes[l];
+  }
+  uint64_t c;
+  c = d[0] >> 26; h[0] = d[0] & LIMB_MASK;
+  d[1] += c;      c = d[1] >> 26; h[1] = d[1] & LIMB_MASK;
+  d[2] += c;      c = d[2] >> 26; h[2] = d[2] & LIMB_MASK;
+  d[3] += c;      c = d[3] >> 26; h[3] = d[3] & LIMB_MASK;
+  d[4] += c;      c = d[4] >> 26; h[4] = d[4] & LIMB_MASK;
+  h[0] += c * 5;  c = h[0] >> 26; h[0] &= LIMB_MASK;
+  h[1] += c;
+}
+
+#if defined(__SSE2__)
+/// Two blocks per chunk, lanes hold blocks 0, 1.
+struct Sse2Ops {
+  using V = __m128i;
+  static constexpr unsigned LANES = 2;
+  static V set1 (uint64_t v)            { return _mm_set1_epi64x (v); }
+  static V set_first (uint64_t v)       { return _mm_set_epi64x (0, v); }
+  static V lane_powers (const uint32_t pow[4][5], unsigned i, uint32_t f) { return _mm_set_epi64x (pow[0][i] * f, pow[1][i] * f); }
+  static V add (V a, V b)               { return _mm_add_epi64 (a, b); }
+  static V mul (V a, V b)               { return _mm_mul_epu32 (a, b); }
+  static V band (V a, V b)              { return _mm_and_si128 (a, b); }
+  static V bor (V a, V b)               { return _mm_or_si128 (a, b); }
+  template<int N> static V srli (V a)   { return _mm_srli_epi64 (a, N); }
+  template<int N> static V slli (V a)   { return _mm_slli_epi64 (a, N); }
+  static void store (uint64_t *d, V a)  { _mm_storeu_si128 (reinterpret_cast<__m128i*> (d), a); }
+  static void
+  load (const uint8_t *m, V &lo, V &hi)
+  {
+    const V a = _mm_loadu_si128 (reinterpret_cast<const __m128i*> (m)), b = _mm_loadu_si128 (reinterpret_cast<const __m128i*> (m + 16));
+    lo = _mm_unpacklo_epi64 (a, b);
+    hi = _mm_unpackhi_epi64 (a, b);
+  }
+};
+#endif // __SSE2__
+
+#if defined(__AVX2__)
+/// Four blocks per chunk, the in-lane unpacks leave lanes holding blocks 0, 2, 1, 3.
+struct Avx2Ops {
+  using V = __m256i;
+  static constexpr unsigned LANES = 4;
+  static V set1 (uint64_t v)            { return _mm256_set1_epi64x (v); }
+  static V set_first (uint64_t v)       { return _mm256_set_epi64x (0, 0, 0, v); }
+  static V lane_powers (const uint32_t pow[4][5], unsigned i, uint32_t f) { return _mm256_set_epi64x (pow[0][i] * f, pow[2][i] * f, pow[1][i] * f, pow[3][i] * f); }
+  static V add (V a, V b)               { return _mm256_add_epi64 (a, b); }
+  static V mul (V a, V b)               { return _mm256_mul_epu32 (a, b); }
+  static V band (V a, V b)              { return _mm256_and_si256 (a, b); }
+  static V bor (V a, V b)               { return _mm256_or_si256 (a, b); }
+  template<int N> static V srli (V a)   { return _mm256_srli_epi64 (a, N); }
+  template<int N> static V slli (V a)   { return _mm256_slli_epi64 (a, N); }
+  static void store (uint64_t *d, V a)  { _mm256_storeu_si256 (reinterpret_cast<__m256i*> (d), a); }
+  static void
+  load (const uint8_t *m, V &lo, V &hi)
+  {
+    const V a = _mm256_loadu_si256 (reinterpret_cast<const __m256i*> (m)), b = _mm256_loadu_si256 (reinterpret_cast<const __m256i*> (m + 32));
+    lo = _mm256_unpacklo_epi64 (a, b);
+    hi = _mm256_unpackhi_epi64 (a, b);
+  }
+};
+#endif // __AVX2__
+} // Poly
+
+/// Poly1305 one-time authenticator (RFC 8439), long inputs use the widest available SIMD path.
+class Poly1305 {
+  uint32_t r_[4][5];    // r, r^2, r^3, r^4
+  uint32_t h_[5] = { 0, 0, 0, 0, 0 };
+  uint32_t pad_[4];
+  uint8_t  buffer_[16];
+  size_t   buffered_ = 0;
+  unsigned kind_;
+  /// Erase the one-time key halves, the accumulator and buffered message bytes.
+  void
+  wipe () noexcept
+  {
+    secure_zero (r_, sizeof (r_));
+    secure_zero (h_, sizeof (h_));
+    secure_zero (pad_, sizeof (pad_));
+    secure_zero (buffer_, sizeof (buffer_));
+    buffered_ = 0;
+  }
+  void
+  blocks (const uint8_t *m, size_t nblocks, uint32_t hibit) noexcept
+  {
+    for (size_t i = 0; i < nblocks; i++, m += 16) {
+      uint32_t x[5];
+      Poly::load_limbs (x, m, hibit);
+      for (unsigned j = 0; j < 5; j++)
+        h_[j] += x[j];
+      Poly::mul_limbs (h_, r_[0]);
+    }
+  }
+public:
+  /// Setup with a 32 byte one-time key, `kind` limits the SIMD paths like generate_blocks().
+  explicit
+  Poly1305 (const uint8_t key[32], unsigned kind = ~0) noexcept :
+    kind_ (kind)
+  {
+    using Alu::load32;
+    // r &= 0xffffffc0ffffffc0ffffffc0fffffff
+    r_[0][0] = (load32 (&key[ 0]) >> 0) & 0x3ffffff;
+    r_[0][1] = (load32 (&key[ 3]) >> 2) & 0x3ffff03;
+    r_[0][2] = (load32 (&key[ 6]) >> 4) & 0x3ffc0ff;
+    r_[0][3] = (load32 (&key[ 9]) >> 6) & 0x3f03fff;
+    r_[0][4] = (load32 (&key[12]) >> 8) & 0x00fffff;
+    for (unsigned k = 1; k < 4; k++) {
+      memcpy (r_[k], r_[k - 1], sizeof (r_[k]));
+      Poly::mul_limbs (r_[k], r_[0]);
+    }
+    for (unsigned i = 0; i < 4; i++)
+      pad_[i] = load32 (&key[16 + 4 * i]);
+  }
+  ~Poly1305()
+  {
+    wipe();
+  }
+  /// Absorb `n` bytes of message.
+  void
+  update (const uint8_t *m, size_t n) noexcept
+  {
+    if (buffered_) {
+      const size_t l = std::min (n, 16 - buffered_);
+      memcpy (buffer_ + buffered_, m, l);
+      buffered_ += l;
+      m += l;
+      n -= l;
+      if (buffered_ < 16)
+        return;
+      blocks (buffer_, 1, 1 << 24);
+      buffered_ = 0;
+    }
+#if defined(__AVX2__)
+    if (kind_ >= 4 && n >= 4 * 64) {
+      const size_t nchunks = n / 64;
+      Poly::blocks_simd<Poly::Avx2Ops> (h_, r_, m, nchunks);
+      m += nchunks * 64;
+      n -= nchunks * 64;
+    }
+#endif
+#if defined(__SSE2__)
+    if (kind_ >= 2 && n >= 4 * 32) {
+      const size_t nchunks = n / 32;
+      Poly::blocks_simd<Poly::Sse2Ops> (h_, r_, m, nchunks);
+      m += nchunks * 32;
+      n -= nchunks * 32;
+    }
+#endif
+    blocks (m, n / 16, 1 << 24);
+    m += n & ~size_t (15);
+    n &= 15;
+    memcpy (buffer_, m, n);
+    buffered_ = n;
+  }
+  /// Absorb zeros up to the next multiple of 16 bytes, as used by the AEAD construction.
+  void
+  pad16 () noexcept
+  {
+    if (buffered_) {
+      memset (buffer_ + buffered_, 0, 16 - buffered_);
+      blocks (buffer_, 1, 1 << 24);
+      buffered_ = 0;
+    }
+  }
+  /// Compute the 16 byte tag.
+  void
+  finish (uint8_t tag[16]) noexcept
+  {
+    if (buffered_) { // final partial block, padded with 0x01 and without the high bit
+      buffer_[buffered_] = 1;
+      memset (buffer_ + buffered_ + 1, 0, 15 - buffered_);
+      blocks (buffer_, 1, 0);
+      buffered_ = 0;
+    }
+    using Poly::LIMB_MASK;
+    uint32_t h0 = h_[0], h1 = h_[1], h2 = h_[2], h3 = h_[3], h4 = h_[4], c;
+    // fully carry h
+    c = h1 >> 26; h1 &= LIMB_MASK;
+    h2 += c; c = h2 >> 26; h2 &= LIMB_MASK;
+    h3 += c; c = h3 >> 26; h3 &= LIMB_MASK;
+    h4 += c; c = h4 >> 26; h4 &= LIMB_MASK;
+    h0 += c * 5; c = h0 >> 26; h0 &= LIMB_MASK;
+    h1 += c;
+    // compute h + -p
+    uint32_t g0 = h0 + 5; c = g0 >> 26; g0 &= LIMB_MASK;
+    uint32_t g1 = h1 + c; c = g1 >> 26; g1 &= LIMB_MASK;
+    uint32_t g2 = h2 + c; c = g2 >> 26; g2 &= LIMB_MASK;
+    uint32_t g3 = h3 + c; c = g3 >> 26; g3 &= LIMB_MASK;
+    uint32_t g4 = h4 + c - (1 << 26);
+    // select h if h < p, or h + -p if h >= p, in constant time
+    uint32_t mask = (g4 >> 31) - 1;
+    h0 = (h0 & ~mask) | (g0 & mask);
+    h1 = (h1 & ~mask) | (g1 & mask);
+    h2 = (h2 & ~mask) | (g2 & mask);
+    h3 = (h3 & ~mask) | (g3 & mask);
+    h4 = (h4 & ~mask) | (g4 & mask);
+    // h = (h + pad) % 2^128
+    uint64_t f;
+    f = uint64_t (h0 | (h1 << 26)) + pad_[0];                     Alu::store32 (&tag[ 0], f);
+    f = uint64_t ((h1 >>  6) | (h2 << 20)) + pad_[1] + (f >> 32); Alu::store32 (&tag[ 4], f);
+    f = uint64_t ((h2 >> 12) | (h3 << 14)) + pad_[2] + (f >> 32); Alu::store32 (&tag[ 8], f);
+    f = uint64_t ((h3 >> 18) | (h4 <<  8)) + pad_[3] + (f >> 32); Alu::store32 (&tag[12], f);
+    wipe();
+  }
+};
+
+/// Longest AEAD message per nonce (RFC 8439 2.8), the 32 bit block counter runs from 1 to 2^32 - 1.
+static constexpr uint64_t AEAD_MAX_LENGTH = (uint64_t (1) << 32) * 64 - 64;
+
+/// Encrypt `length` bytes in cache resident chunks, `mac` absorbs the ciphertext of each chunk.
+static void
+aead_encrypt (std::array<uint32_t, 16> &state, Poly1305 &mac, const uint8_t *input, uint8_t *output, size_t length)
+{
+  constexpr size_t CHUNK = 16 * 64;
+  for (size_t i = 0; i < length; i += CHUNK) {
+    const size_t n = std::min (CHUNK, length - i);
+    encrypt (state, n, input + i, output + i, 20);
+    mac.update (output + i, n);
+  }
+}
+
+/// Setup ChaCha20 at block 1 and Poly1305 from the one-time key of block 0 (RFC 8439 2.6).
+static Poly1305
+aead_setup (std::array<uint32_t, 16> &state, const std::array<uint8_t, 32> &key, const std::array<uint8_t, 12> &nonce,
+            const uint8_t *aad, size_t aad_length)
+{
+  rfc7539_setup (state, key, nonce, 0);
+  std::array<uint8_t, 64> otk;
+  alu_block (state, nullptr, otk.data(), 20);
+  Poly1305 mac (otk.data());
+  secure_zero (otk.data(), otk.size());
+  mac.update (aad, aad_length);
+  mac.pad16();
+  return mac;
+}
+
+/// Absorb the padding and lengths of the AEAD construction and compute the tag.
+static void
+aead_finish (Poly1305 &mac, size_t aad_length, size_t length, uint8_t tag[16])
+{
+  mac.pad16();
+  uint8_t lengths[16];
+  const uint64_t a = aslittle64 (aad_length), l = aslittle64 (length);
+  memcpy (&lengths[0], &a, 8);
+  memcpy (&lengths[8], &l, 8);
+  mac.update (lengths, 16);
+  mac.finish (tag);
+}
+
+/** ChaCha20-Poly1305 AEAD encryption (RFC 8439), writes `length` bytes of `ciphertext` and the 16 byte `tag`.
+ * Returns false without writing anything if `length` exceeds AEAD_MAX_LENGTH.
+ */
+static bool
+seal (const std::array<uint8_t, 32> &key, const std::array<uint8_t, 12> &nonce, const uint8_t *aad, size_t aad_length,
+      const uint8_t *plaintext, size_t length, uint8_t *ciphertext, uint8_t tag[16])
+{
+  if (length > AEAD_MAX_LENGTH)
+    return false;
+  std::array<uint32_t, 16> state;
+  Poly1305 mac = aead_setup (state, key, nonce, aad, aad_length);
+  aead_encrypt (state, mac, plaintext, ciphertext, length);
+  aead_finish (mac, aad_length, length, tag);
+  secure_zero (state.data(), sizeof (state));
+  return true;
+}
+
+/** ChaCha20-Poly1305 AEAD decryption (RFC 8439), writes `length` bytes of `plaintext` if `tag` matches.
+ * The tag is verified before decrypting, returns false without writing `plaintext` if it does not match
+ * or if `length` exceeds AEAD_MAX_LENGTH.
+ */
+static bool
+open (const std::array<uint8_t, 32> &key, const std::array<uint8_t, 12> &nonce, const uint8_t *aad, size_t aad_length,
+      const uint8_t *ciphertext, size_t length, uint8_t *plaintext, const uint8_t tag[16])
+{
+  if (length > AEAD_MAX_LENGTH)
+    return false;
+  std::array<uint32_t, 16> state;
+  Poly1305 mac = aead_setup (state, key, nonce, aad, aad_length);
+  mac.update (ciphertext, length);
+  uint8_t expected[16];
+  aead_finish (mac, aad_length, length, expected);
+  uint8_t diff = 0;
+  for (size_t i = 0; i < 16; i++)
+    diff |= expected[i] ^ tag[i];
+  if (!diff)
+    encrypt (state, length, ciphertext, plaintext, 20);
+  secure_zero (state.data(), sizeof (state));
+  return !diff;
+}
+
 } // ChaCha
 
 #endif // __CHACHA_HH__
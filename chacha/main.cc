@@ -1,23 +1,86 @@
 // Dedicated to the Public Domain under the Unlicense: https://unlicense.org/UNLICENSE
 
 #include <chrono>               // std::chrono
+#include <cctype>
 #include <sys/random.h>
+#include <thread>
+#include <atomic>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "chacha.cc"
+#include "../generate-threaded.hh"
 
 /// Return the current time as uint64 in nanoseconds.
 extern inline uint64_t timestamp_nsecs() { return std::chrono::steady_clock::now().time_since_epoch().count(); }
 
+/** Time fills of a buffer larger than the last level cache and a consumer pass over a separate working set.
+ * With regular stores the fill evicts the working set, non-temporal stores leave it cache resident.
+ */
+template<class Fill> static void
+llc_consumer_bench (const char *what, const Fill &fill)
+{
+  constexpr size_t FILL = 512 * 1024 * 1024, WSET = 16 * 1024 * 1024, ROUNDS = 4, LINES = WSET / 64;
+  std::vector<uint64_t> wset (WSET / 8, 1);
+  uint8_t *const buffer = (uint8_t*) aligned_alloc (64, FILL);
+  memset (buffer, 0, FILL); // fault in pages
+  uint64_t tfill = 0, tuse = 0, sum = 0;
+  for (size_t r = 0; r < ROUNDS; r++) {
+    for (size_t i = 0; i < LINES; i++) // one access per cache line, in an order the prefetchers cannot follow
+      sum += wset[(i * 0x9E3779B1 & (LINES - 1)) * 8];
+    const uint64_t t1 = timestamp_nsecs();
+    fill (buffer, FILL);
+    const uint64_t t2 = timestamp_nsecs();
+    for (size_t i = 0; i < LINES; i++)
+      sum += wset[(i * 0x9E3779B1 & (LINES - 1)) * 8];
+    const uint64_t t3 = timestamp_nsecs();
+    tfill += t2 - t1;
+    tuse += t3 - t2;
+  }
+  free (buffer);
+  assert (sum == ROUNDS * 2 * LINES);
+  dprintf (2, " %-28s %f GB/sec fill, %.3f msecs consumer pass over a %zu MB working set\n", what,
+           ROUNDS * FILL * (1000000000.0 / (1024*1024*1024)) / tfill, tuse / 1000000.0 / ROUNDS, WSET >> 20);
+}
+
+/// Generate the keystream with `threads` workers, chunk `k` starts at block counter `k * chunk / 64`.
+static uint64_t
+generate_counter_ranges (uint64_t nonce, const std::array<uint8_t, 32> &key, const uint64_t nbytes, const unsigned rounds, unsigned kind,
+                         unsigned threads, size_t chunk, FILE *fout)
+{
+  assert (chunk % 64 == 0);
+  return generate_threaded (threads, nbytes, chunk, fout, [&] (unsigned) {
+    return [nonce, key, rounds, kind, chunk] (uint64_t k, uint8_t *dest) {
+      std::array<uint32_t, 16> state;
+      ChaCha::key_setup (state, 256, key, nonce, k * (chunk / 64));
+      for (uint8_t *const end = dest + chunk; dest < end; /**/) {
+        const size_t n = ChaCha::generate_blocks (state, end - dest, nullptr, dest, rounds, kind);
+        if (n)
+          dest += n;
+        else { // generate_blocks() leaves the last block
+          ChaCha::alu_block (state, nullptr, dest, rounds);
+          dest += 64;
+        }
+      }
+    };
+  });
+}
+
 static uint64_t
-generate_bytes (uint64_t nonce, const std::array<uint8_t, 32> &key, const uint64_t nbytes, const unsigned rounds, unsigned kind, FILE *fout)
+generate_bytes (uint64_t nonce, const std::array<uint8_t, 32> &key, const uint64_t nbytes, const unsigned rounds, unsigned kind,
+                unsigned threads, FILE *fout)
 {
+  if (threads) // counter ranges reproduce the single threaded keystream
+    return generate_counter_ranges (nonce, key, nbytes, rounds, kind, threads, 1024 * 1024, fout);
   const unsigned N = std::min (nbytes, 64 * 1024 * 1024ul);
   std::vector<uint8_t> buffer (N, 0);
   std::array<uint32_t, 16> state;
   ChaCha::key_setup (state, 256, key, nonce);
   size_t total;
   for (total = 0; total < nbytes; /**/) {
-    uint8_t *start = buffer.data(), *last = start + N - 64 * ChaCha::avx_blocks;
+    uint8_t *start = buffer.data(), *last = start + N - 64 * ChaCha::chacha_max_blocks;
     while (start < last)
       start += ChaCha::generate_blocks (state, N, nullptr, start, rounds, kind);
     if (fout)
@@ -27,6 +90,710 @@ generate_bytes (uint64_t nonce, const std::array<uint8_t, 32> &key, const uint64
   return total;
 }
 
+/// Print Poly1305 throughput per SIMD path and ChaCha20-Poly1305 seal/open throughput for `nbytes`.
+static void
+aead_bench (const std::array<uint8_t, 32> &key, const uint64_t nbytes)
+{
+  const size_t N = 64 * 1024;
+  std::vector<uint8_t> plain (N, 0x55), cipher (N);
+  const std::array<uint8_t, 12> nonce{};
+  uint8_t tag[16];
+  auto report = [nbytes] (const char *what, uint64_t t1, uint64_t t2) {
+    dprintf (2, " %-24s %.3f msecs, %f GB/sec\n", what, (t2 - t1) / 1000000.0, nbytes * (1000000000.0 / (1024*1024*1024)) / (t2 - t1));
+  };
+  for (const auto &[name, kind] : { std::pair ("Poly1305 ALU", 1u), std::pair ("Poly1305 SSE2", 2u), std::pair ("Poly1305 AVX2", 4u) }) {
+    ChaCha::Poly1305 mac (key.data(), kind);
+    auto t1 = timestamp_nsecs();
+    for (uint64_t total = 0; total < nbytes; total += N)
+      mac.update (plain.data(), N);
+    mac.finish (tag);
+    report (name, t1, timestamp_nsecs());
+  }
+  auto t1 = timestamp_nsecs();
+  bool ok = true;
+  for (uint64_t total = 0; total < nbytes; total += N)
+    ok &= ChaCha::seal (key, nonce, nullptr, 0, plain.data(), N, cipher.data(), tag);
+  auto t2 = timestamp_nsecs();
+  report ("ChaCha20-Poly1305 seal", t1, t2);
+  for (uint64_t total = 0; total < nbytes; total += N)
+    ok &= ChaCha::open (key, nonce, nullptr, 0, cipher.data(), N, plain.data(), tag);
+  report ("ChaCha20-Poly1305 open", t2, timestamp_nsecs());
+  assert (ok);
+}
+
+/// Print the HChaCha20 subkey rate for one nonce at a time and for hchacha20_batch().
+static void
+hchacha_bench (const std::array<uint8_t, 32> &key)
+{
+  constexpr size_t N = 4096, ROUNDS = 64;
+  std::vector<std::array<uint8_t, 16>> nonces (N);
+  std::vector<std::array<uint8_t, 32>> subkeys (N);
+  for (size_t i = 0; i < N; i++)
+    memcpy (nonces[i].data(), &i, sizeof (i));
+  auto t1 = timestamp_nsecs();
+  for (size_t r = 0; r < ROUNDS; r++)
+    for (size_t i = 0; i < N; i++)
+      ChaCha::hchacha20 (subkeys[i], key, nonces[i].data());
+  auto t2 = timestamp_nsecs();
+  for (size_t r = 0; r < ROUNDS; r++)
+    ChaCha::hchacha20_batch (subkeys.data(), key, nonces.data(), N);
+  auto t3 = timestamp_nsecs();
+  dprintf (2, " %-24s %.3f M subkeys/sec\n", "HChaCha20", N * ROUNDS * 1000.0 / (t2 - t1));
+  dprintf (2, " %-24s %.3f M subkeys/sec, speedup: %.2fx\n", "HChaCha20 batch", N * ROUNDS * 1000.0 / (t3 - t2), (t2 - t1) / double (t3 - t2));
+}
+
+/// Compare small ChaCha::Rng draws with memcpy() from a buffer of the same size.
+static void
+rng_bench (const std::array<uint8_t, 32> &key)
+{
+  constexpr size_t N = 64 * 1024 * 1024;
+  ChaCha::Rng rng (key);
+  uint64_t sum = 0;
+  auto t1 = timestamp_nsecs();
+  for (size_t i = 0; i < N / 8; i++)
+    sum += rng.next64();
+  auto t2 = timestamp_nsecs();
+  uint8_t draw[16], src[4096] = { 1, };
+  for (size_t i = 0; i < N / 16; i++) {
+    rng.fill (draw, 16);
+    sum += draw[0];
+  }
+  auto t3 = timestamp_nsecs();
+  for (size_t i = 0; i < N / 16; i++) {
+    memcpy (draw, src + (i * 16) % sizeof (src), 16);
+    asm volatile ("" : : "r" (draw) : "memory");
+    sum += draw[0];
+  }
+  auto t4 = timestamp_nsecs();
+  const double gb = N * (1000000000.0 / (1024*1024*1024));
+  dprintf (2, " %-24s %f GB/sec, %.1f ns/draw\n", "Rng next64()", gb / (t2 - t1), (t2 - t1) / (N / 8.0));
+  dprintf (2, " %-24s %f GB/sec, %.1f ns/draw\n", "Rng fill() 16 bytes", gb / (t3 - t2), (t3 - t2) / (N / 16.0));
+  dprintf (2, " %-24s %f GB/sec, %.1f ns/draw (%u)\n", "memcpy() 16 bytes", gb / (t4 - t3), (t4 - t3) / (N / 16.0), unsigned (sum & 1));
+}
+
+/// Print p50/p99/p99.9 latency of 16 byte draws from ChaCha::Rng and from ChaCha::RngRing, with idle gaps between bursts.
+static void
+rng_ring_bench (const std::array<uint8_t, 32> &key)
+{
+  constexpr size_t BURST = 256, BURSTS = 2048;
+  auto measure = [&] (const char *what, auto &rng) {
+    std::vector<uint64_t> ns;
+    ns.reserve (BURST * BURSTS);
+    uint8_t draw[16];
+    for (size_t b = 0; b < BURSTS; b++) {
+      std::this_thread::sleep_for (std::chrono::microseconds (50));  // request handler idle time
+      for (size_t i = 0; i < BURST; i++) {
+        const uint64_t t = timestamp_nsecs();
+        rng.fill (draw, sizeof (draw));
+        ns.push_back (timestamp_nsecs() - t);
+      }
+    }
+    std::sort (ns.begin(), ns.end());
+    dprintf (2, " %-24s p50: %4u ns  p99: %4u ns  p99.9: %5u ns\n", what,
+             unsigned (ns[ns.size() / 2]), unsigned (ns[ns.size() * 99 / 100]), unsigned (ns[ns.size() * 999 / 1000]));
+  };
+  ChaCha::Rng rng (key);
+  measure ("Rng inline 16 bytes", rng);
+  ChaCha::RngRing ring (key);
+  std::this_thread::sleep_for (std::chrono::milliseconds (1));
+  measure ("RngRing 16 bytes", ring);
+  dprintf (2, " %-24s %llu bytes\n", "RngRing inline fallback", (unsigned long long) ring.inline_bytes());
+}
+
+/// Compare the runtime round loop (ROUNDS = 0) of each kernel with its ChaCha8 specialization.
+static void
+rounds_bench (uint64_t nonce, const std::array<uint8_t, 32> &key)
+{
+  using Kernel = void (*) (std::array<uint32_t, 16>&, const uint8_t*, uint8_t*, unsigned);
+  constexpr size_t N = 16 * 1024, REPEAT = 4096;
+  alignas (64) static uint8_t buffer[N];
+  std::array<uint32_t, 16> state;
+  ChaCha::key_setup (state, 256, key, nonce);
+  auto run = [&] (Kernel kernel, unsigned blocks) {
+    auto t = timestamp_nsecs();
+    for (size_t r = 0; r < REPEAT; r++)
+      for (size_t i = 0; i + 64 * blocks <= N; i += 64 * blocks)
+        kernel (state, nullptr, buffer + i, 8);
+    return timestamp_nsecs() - t;
+  };
+  auto bench = [&] (const char *what, Kernel generic, Kernel chacha8, unsigned blocks) {
+    const auto t1 = run (generic, blocks), t2 = run (chacha8, blocks);
+    dprintf (2, " %-24s %f GB/sec, speedup: %.2fx\n", what, N * REPEAT * (1000000000.0 / (1024*1024*1024)) / t2, t1 / double (t2));
+  };
+  bench ("ChaCha8 alu_block", ChaCha::alu_rounds<0>, ChaCha::alu_rounds<8>, 1);
+#if defined(__SSE2__)
+  bench ("ChaCha8 sse_block", ChaCha::sse_rounds<0>, ChaCha::sse_rounds<8>, ChaCha::sse_blocks);
+#endif
+#if defined(__AVX2__)
+  bench ("ChaCha8 avx2_block", ChaCha::avx2_rounds<false, 0>, ChaCha::avx2_rounds<false, 8>, ChaCha::avx_blocks);
+#endif
+#if defined(__AVX512F__)
+  bench ("ChaCha8 avx512_block", ChaCha::avx512_rounds<0>, ChaCha::avx512_rounds<8>, ChaCha::avx512_blocks);
+#endif
+}
+
+/// Compare encrypt() per message with encrypt_many() for 64 - 256 byte messages under different keys.
+static void
+many_bench (uint64_t nonce)
+{
+  constexpr size_t N = 4096, ROUNDS = 64;
+  std::vector<std::array<uint32_t, 16>> states (N);
+  std::vector<ChaCha::Message> messages (N);
+  std::vector<uint8_t> buffer (N * 256);
+  size_t nbytes = 0;
+  for (size_t i = 0; i < N; i++) {
+    std::array<uint8_t, 32> key { 0 };
+    memcpy (key.data(), &i, sizeof (i));
+    ChaCha::key_setup (states[i], 256, key, nonce);
+    const size_t length = 64 + 64 * (i % 4);
+    messages[i] = { &states[i], buffer.data() + i * 256, buffer.data() + i * 256, length };
+    nbytes += length;
+  }
+  auto t1 = timestamp_nsecs();
+  for (size_t r = 0; r < ROUNDS; r++)
+    for (auto &m : messages)
+      ChaCha::encrypt (*m.state, m.length, m.input, m.output, 20);
+  auto t2 = timestamp_nsecs();
+  for (size_t r = 0; r < ROUNDS; r++)
+    ChaCha::encrypt_many (messages.data(), N);
+  auto t3 = timestamp_nsecs();
+  const double gb = nbytes * ROUNDS * (1000000000.0 / (1024*1024*1024));
+  dprintf (2, " %-24s %f GB/sec\n", "encrypt() per message", gb / (t2 - t1));
+  dprintf (2, " %-24s %f GB/sec, speedup: %.2fx\n", "encrypt_many()", gb / (t3 - t2), (t2 - t1) / double (t3 - t2));
+}
+
+/// Print the rate of decrypting random 4KB pages with encrypt_range() and the throughput of encrypt_parallel().
+static void
+range_bench (uint64_t nonce, const std::array<uint8_t, 32> &key)
+{
+  constexpr size_t PAGE = 4096, NPAGES = 64 * 1024;
+  std::vector<uint8_t> page (PAGE);
+  uint64_t x = nonce | 1;
+  auto t1 = timestamp_nsecs();
+  for (size_t i = 0; i < NPAGES; i++) {
+    x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+    const uint64_t offset = (x % (uint64_t (1) << 40)) & ~uint64_t (PAGE - 1); // page of a 1TB file
+    ChaCha::encrypt_range (key, nonce, offset, page.data(), page.data(), PAGE);
+  }
+  auto t2 = timestamp_nsecs();
+  dprintf (2, " %-24s %.3f M pages/sec, %f GB/sec\n", "encrypt_range() 4KB", NPAGES * 1000.0 / (t2 - t1),
+           NPAGES * PAGE * (1000000000.0 / (1024*1024*1024)) / (t2 - t1));
+  const unsigned nthreads = std::max (1u, std::thread::hardware_concurrency());
+  std::vector<uint8_t> buffer (256 * 1024 * 1024);
+  auto t3 = timestamp_nsecs();
+  ChaCha::encrypt_parallel (key, nonce, 0, buffer.data(), buffer.data(), buffer.size(), nthreads);
+  auto t4 = timestamp_nsecs();
+  dprintf (2, " %-24s %.3f msecs, %f GB/sec with %u threads\n", "encrypt_parallel()", (t4 - t3) / 1000000.0,
+           buffer.size() * (1000000000.0 / (1024*1024*1024)) / (t4 - t3), nthreads);
+}
+
+/// Compare encrypting 1500 byte packets with ChaCha::Stream against one bulk encrypt() call.
+static void
+packet_bench (uint64_t nonce, const std::array<uint8_t, 32> &key)
+{
+  constexpr size_t PACKET = 1500, N = 64 * 1024 * 1024;
+  std::vector<uint8_t> buffer (N);
+  std::array<uint32_t, 16> state;
+  ChaCha::key_setup (state, 256, key, nonce);
+  auto t1 = timestamp_nsecs();
+  ChaCha::encrypt (state, N, buffer.data(), buffer.data(), 20);
+  auto t2 = timestamp_nsecs();
+  ChaCha::Stream stream (key, nonce);
+  for (size_t i = 0; i < N; i += PACKET)
+    stream.update (buffer.data() + i, buffer.data() + i, std::min (PACKET, N - i));
+  auto t3 = timestamp_nsecs();
+  dprintf (2, " %-24s %f GB/sec\n", "encrypt() bulk", N * (1000000000.0 / (1024*1024*1024)) / (t2 - t1));
+  dprintf (2, " %-24s %f GB/sec, %.2fx of bulk\n", "Stream 1500B packets", N * (1000000000.0 / (1024*1024*1024)) / (t3 - t2),
+           (t2 - t1) / double (t3 - t2));
+}
+
+// == File encryption ==
+// Encrypted files start with FILE_MAGIC and the 64 bit nonce in little endian, followed by the plaintext
+// in FILE_CHUNK pieces, each sealed with ChaCha20-Poly1305 and followed by its FILE_TAG byte tag.
+// Chunk `k` uses the file nonce and `k` as its 96 bit nonce, its one byte associated data is 1 for the
+// last chunk and 0 otherwise, so reordered, dropped or truncated chunks fail to open. Every file has at
+// least one, possibly empty, chunk.
+static constexpr char   FILE_MAGIC[8] = { 'C', 'h', 'a', 'P', 'o', 'l', 'y', '1' };
+static constexpr size_t FILE_HEADER = 16;
+static constexpr size_t FILE_CHUNK = 32 * 1024 * 1024;
+static constexpr size_t FILE_TAG = 16;
+
+/// Number of chunks of `length` plaintext bytes.
+static uint64_t
+file_chunks (uint64_t length)
+{
+  return length ? (length + FILE_CHUNK - 1) / FILE_CHUNK : 1;
+}
+
+/** Seal (or with `decrypt` open) chunk `k` of `n` plaintext bytes from `in` to `out`, the tag follows the
+ * ciphertext. Returns false if the tag of a chunk does not match, `out` is left untouched then.
+ */
+static bool
+crypt_chunk (const std::array<uint8_t, 32> &key, uint64_t nonce, uint64_t k, bool last, bool decrypt,
+             const uint8_t *in, uint8_t *out, size_t n)
+{
+  std::array<uint8_t, 12> chunk_nonce;
+  ChaCha::Alu::store32 (&chunk_nonce[0], nonce);
+  ChaCha::Alu::store32 (&chunk_nonce[4], nonce >> 32);
+  ChaCha::Alu::store32 (&chunk_nonce[8], k);
+  const uint8_t aad = last;
+  if (decrypt)
+    return ChaCha::open (key, chunk_nonce, &aad, 1, in, n, out, in + n);
+  return ChaCha::seal (key, chunk_nonce, &aad, 1, in, n, out, out + n);
+}
+
+/// Call `fn (k)` for all `k < nchunks` on up to `nthreads` threads, stops at the first nonzero result and returns it.
+template<class Fn> static int
+parallel_chunks (size_t nchunks, unsigned nthreads, const Fn &fn)
+{
+  std::atomic<size_t> next { 0 };
+  std::atomic<int> error { 0 };
+  auto worker = [&] () {
+    for (size_t k = next++; k < nchunks && !error; k = next++) {
+      int expected = 0;
+      const int err = fn (k);
+      if (err)
+        error.compare_exchange_strong (expected, err);
+    }
+  };
+  std::vector<std::thread> threads;
+  for (unsigned t = 1; t < std::min (size_t (nthreads), nchunks); t++)
+    threads.emplace_back (worker);
+  worker();
+  for (auto &t : threads)
+    t.join();
+  return error;
+}
+
+static bool
+write_all (int fd, const uint8_t *buf, size_t n)
+{
+  while (n) {
+    const ssize_t r = write (fd, buf, n);
+    if (r < 0 && errno == EINTR)
+      continue;
+    if (r <= 0)
+      return false;
+    buf += r;
+    n -= r;
+  }
+  return true;
+}
+
+static ssize_t
+read_all (int fd, uint8_t *buf, size_t n)
+{
+  size_t got = 0;
+  while (got < n) {
+    const ssize_t r = read (fd, buf + got, n - got);
+    if (r < 0 && errno == EINTR)
+      continue;
+    if (r < 0)
+      return -1;
+    if (r == 0)
+      break;
+    got += r;
+  }
+  return got;
+}
+
+/** Read a 256 bit `key` from `path` ("-" for stdin), which must hold exactly 64 hex digits and an optional newline.
+ * Keys are not taken from argv, where they would show up in ps(1), /proc and the shell history.
+ * Returns false after printing an error, the read buffer is wiped on all paths.
+ */
+static bool
+read_key_file (const char *path, std::array<uint8_t, 32> &key)
+{
+  const int fd = strcmp (path, "-") == 0 ? 0 : open (path, O_RDONLY);
+  if (fd < 0) {
+    dprintf (2, "open: %s: %s\n", path, strerror (errno));
+    return false;
+  }
+  uint8_t buf[66];
+  const ssize_t r = read_all (fd, buf, sizeof (buf));
+  const int saved = errno;
+  if (fd > 0)
+    close (fd);
+  size_t n = std::max (ssize_t (0), r);
+  if (n == 65 && buf[64] == '\n')
+    n = 64;
+  bool valid = r >= 0 && n == 64;
+  for (size_t i = 0; valid && i < 64; i++)
+    valid = isxdigit (buf[i]);
+  for (size_t i = 0; valid && i < 32; i++) {
+    auto nibble = [] (uint8_t c) { return c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10; };
+    key[i] = nibble (buf[2 * i]) << 4 | nibble (buf[2 * i + 1]);
+  }
+  ChaCha::secure_zero (buf, sizeof (buf));
+  if (r < 0)
+    dprintf (2, "read: %s: %s\n", path, strerror (saved));
+  else if (!valid)
+    dprintf (2, "%s: key file needs exactly 64 hex digits\n", path);
+  return valid;
+}
+
+/** Seal (or with `decrypt` open) the `length` plaintext bytes of all chunks between two mappings of `fdin` and
+ * `fdout` from file offset 0, the payload starts at `inskip` and `outskip`. `nthreads` workers take chunks in turn.
+ * Returns 0, EBADMSG if a chunk fails to open, or the errno of the first failed writeback or page cache call.
+ */
+static int
+crypt_mapped (const std::array<uint8_t, 32> &key, uint64_t nonce, bool decrypt, int fdin, const uint8_t *in, size_t inskip,
+              int fdout, uint8_t *out, size_t outskip, size_t length, unsigned nthreads)
+{
+  const size_t nchunks = file_chunks (length), page = sysconf (_SC_PAGESIZE);
+  const size_t rin = FILE_CHUNK + (decrypt ? FILE_TAG : 0), rout = FILE_CHUNK + (decrypt ? 0 : FILE_TAG);
+  const size_t inlen = length + (decrypt ? FILE_TAG * nchunks : 0);
+  return parallel_chunks (nchunks, nthreads, [&] (size_t k) {
+    const size_t n = std::min (FILE_CHUNK, length - k * FILE_CHUNK), offset = k * rin;
+    const size_t nin = n + (decrypt ? FILE_TAG : 0), nout = n + (decrypt ? 0 : FILE_TAG);
+    int err = 0;
+    // start readahead of the chunk this worker is likely to take next while it computes
+    const size_t ahead = offset + nthreads * rin;
+    if (ahead < inlen)
+      err = posix_fadvise (fdin, inskip + ahead, std::min (rin, inlen - ahead), POSIX_FADV_WILLNEED);
+    if (!crypt_chunk (key, nonce, k, k + 1 == nchunks, decrypt, in + inskip + offset, out + outskip + k * rout, n))
+      return EBADMSG;
+    // queue the output for writeback
+    if (!err && sync_file_range (fdout, outskip + k * rout, nout, SYNC_FILE_RANGE_WRITE) < 0)
+      err = errno;
+    // drop the clean input pages, so the page cache does not fill up: unmap them and evict them from the cache.
+    // Ranges are page aligned relative to `in`, each chunk releases up to the page it shares with the next chunk.
+    const size_t begin = (inskip + offset) & -page;
+    const size_t end = k + 1 == nchunks ? inskip + inlen : (inskip + offset + nin) & -page;
+    if (!err && end > begin && madvise ((void*) (in + begin), end - begin, MADV_DONTNEED) < 0)
+      err = errno;
+    if (!err && end > begin)
+      err = posix_fadvise (fdin, begin, end - begin, POSIX_FADV_DONTNEED);
+    return err;
+  });
+}
+
+/** Seal (or with `decrypt` open) the chunks from `fdin` to `fdout` with read() and write(), e.g. for pipes.
+ * Batches of `nthreads` chunks are processed in parallel. Chunks before a batch that fails to open have
+ * already been written. Returns false with errno set, EBADMSG if a chunk fails to open.
+ */
+static bool
+crypt_streamed (const std::array<uint8_t, 32> &key, uint64_t nonce, bool decrypt, int fdin, int fdout, unsigned nthreads,
+                uint64_t *total)
+{
+  const size_t rin = FILE_CHUNK + (decrypt ? FILE_TAG : 0), rout = FILE_CHUNK + (decrypt ? 0 : FILE_TAG);
+  const size_t batch = std::max (1u, nthreads);
+  // one extra byte tells whether a full batch is followed by more input, i.e. holds no last chunk
+  std::vector<uint8_t> in (batch * rin + 1), out (batch * rout);
+  size_t have = 0;
+  for (uint64_t k = 0; ; ) {
+    const ssize_t r = read_all (fdin, in.data() + have, in.size() - have);
+    if (r < 0)
+      return false;
+    have += r;
+    const bool eof = have < in.size();
+    const size_t used = eof ? have : batch * rin, m = eof ? std::max (size_t (1), (have + rin - 1) / rin) : batch;
+    if (decrypt && used < (m - 1) * rin + FILE_TAG) {
+      errno = EBADMSG; // no room for the tag of the last chunk
+      return false;
+    }
+    if (k + m > uint64_t (1) << 32) {
+      errno = EFBIG;
+      return false;
+    }
+    const int err = parallel_chunks (m, nthreads, [&] (size_t j) {
+      const size_t n = std::min (rin, used - j * rin) - (decrypt ? FILE_TAG : 0);
+      return crypt_chunk (key, nonce, k + j, eof && j + 1 == m, decrypt, &in[j * rin], &out[j * rout], n) ? 0 : EBADMSG;
+    });
+    if (err) {
+      errno = err;
+      return false;
+    }
+    const size_t nout = decrypt ? used - FILE_TAG * m : used + FILE_TAG * m;
+    if (!write_all (fdout, out.data(), nout))
+      return false;
+    *total += decrypt ? nout : used;
+    k += m;
+    if (eof)
+      return true;
+    in[0] = in[used];
+    have = 1;
+  }
+}
+
+/** Encrypt (or with `decrypt` decrypt) file `inpath` to `outpath`, "-" denotes stdin or stdout.
+ * Regular files are mapped and their chunks processed on `nthreads` threads, with the page faults
+ * of one thread overlapping the work of the others. Other files are streamed in batches of chunks.
+ * The output is only created or truncated once the input header is valid. If a chunk fails to open,
+ * a regular output file is truncated to 0 bytes, a stream may have received the chunks before it.
+ * Returns the number of plaintext bytes processed or -1 after printing an error.
+ */
+static int64_t
+crypt_file (const char *inpath, const char *outpath, const std::array<uint8_t, 32> &key, bool decrypt, unsigned nthreads)
+{
+  // release descriptors and mappings on every return path, stdin and stdout stay open
+  struct Files {
+    int fdin = -1, fdout = -1;
+    uint8_t *in = nullptr, *out = nullptr;
+    size_t inlen = 0, outlen = 0;
+    ~Files()
+    {
+      if (in)
+        munmap (in, inlen);
+      if (out)
+        munmap (out, outlen);
+      if (fdin > 0)
+        close (fdin);
+      if (fdout > 1)
+        close (fdout);
+    }
+  } f;
+  auto fail = [] (const char *what, const char *path) {
+    dprintf (2, "%s: %s: %s\n", what, path, strerror (errno));
+    return -1;
+  };
+  f.fdin = strcmp (inpath, "-") == 0 ? 0 : open (inpath, O_RDONLY);
+  if (f.fdin < 0)
+    return fail ("open", inpath);
+  // header
+  uint8_t header[FILE_HEADER];
+  uint64_t nonce;
+  if (decrypt) {
+    const ssize_t r = read_all (f.fdin, header, FILE_HEADER);
+    if (r < 0)
+      return fail ("read", inpath);
+    if (r != FILE_HEADER) {
+      dprintf (2, "%s: truncated header\n", inpath);
+      return -1;
+    }
+    if (memcmp (header, FILE_MAGIC, 8) != 0) {
+      dprintf (2, "%s: not a ChaCha20-Poly1305 encrypted file\n", inpath);
+      return -1;
+    }
+    nonce = ChaCha::Alu::load32 (header + 8) | uint64_t (ChaCha::Alu::load32 (header + 12)) << 32;
+  } else {
+    if (getrandom (&nonce, sizeof (nonce), 0) != sizeof (nonce))
+      return fail ("getrandom", inpath);
+    memcpy (header, FILE_MAGIC, 8);
+    ChaCha::Alu::store32 (header + 8, nonce);
+    ChaCha::Alu::store32 (header + 12, nonce >> 32);
+  }
+  struct stat sin, sout;
+  if (fstat (f.fdin, &sin) < 0)
+    return fail ("stat", inpath);
+  // plaintext length of mappable input
+  size_t length = 0;
+  if (S_ISREG (sin.st_mode)) {
+    const uint64_t payload = sin.st_size - (decrypt ? FILE_HEADER : 0);
+    const uint64_t nchunks = decrypt ? (payload + FILE_CHUNK + FILE_TAG - 1) / (FILE_CHUNK + FILE_TAG) : file_chunks (payload);
+    if (nchunks > uint64_t (1) << 32) {
+      errno = EFBIG;
+      return fail ("too many chunks", inpath);
+    }
+    if (decrypt && (nchunks == 0 || payload < nchunks * FILE_TAG + (nchunks - 1) * FILE_CHUNK)) {
+      dprintf (2, "%s: truncated chunk\n", inpath);
+      return -1;
+    }
+    length = payload - (decrypt ? nchunks * FILE_TAG : 0);
+  }
+  f.fdout = strcmp (outpath, "-") == 0 ? 1 : open (outpath, O_RDWR | O_CREAT | O_TRUNC, 0600);
+  if (f.fdout < 0)
+    return fail ("open", outpath);
+  if (!decrypt && !write_all (f.fdout, header, FILE_HEADER))
+    return fail ("write", outpath);
+  if (fstat (f.fdout, &sout) < 0)
+    return fail ("stat", outpath);
+  // payload
+  int err = 0;
+  uint64_t total = 0;
+  if (S_ISREG (sin.st_mode) && S_ISREG (sout.st_mode) && length) {
+    const size_t nchunks = file_chunks (length), inskip = decrypt ? FILE_HEADER : 0, outskip = decrypt ? 0 : FILE_HEADER;
+    // map from offset 0, the header is not page aligned
+    f.inlen = sin.st_size;
+    f.outlen = outskip + length + (decrypt ? 0 : nchunks * FILE_TAG);
+    if (ftruncate (f.fdout, f.outlen) < 0)
+      return fail ("ftruncate", outpath);
+    f.in = (uint8_t*) mmap (nullptr, f.inlen, PROT_READ, MAP_SHARED, f.fdin, 0);
+    if (f.in == MAP_FAILED) {
+      f.in = nullptr;
+      return fail ("mmap", inpath);
+    }
+    f.out = (uint8_t*) mmap (nullptr, f.outlen, PROT_READ | PROT_WRITE, MAP_SHARED, f.fdout, 0);
+    if (f.out == MAP_FAILED) {
+      f.out = nullptr;
+      return fail ("mmap", outpath);
+    }
+    if (madvise (f.in, f.inlen, MADV_SEQUENTIAL) < 0)
+      return fail ("madvise", inpath);
+    err = crypt_mapped (key, nonce, decrypt, f.fdin, f.in, inskip, f.fdout, f.out, outskip, length, nthreads);
+    total = length;
+  } else if (!crypt_streamed (key, nonce, decrypt, f.fdin, f.fdout, nthreads, &total))
+    err = errno;
+  if (err == EBADMSG) {
+    dprintf (2, "%s: authentication failed\n", inpath);
+    if (S_ISREG (sout.st_mode) && ftruncate (f.fdout, 0) < 0)
+      fail ("ftruncate", outpath);
+    return -1;
+  }
+  if (err) {
+    errno = err;
+    return fail (f.out ? "writeback" : "read/write", f.out ? outpath : inpath);
+  }
+  if (f.out && munmap (f.out, f.outlen) < 0) {
+    f.out = nullptr;
+    return fail ("munmap", outpath);
+  }
+  f.out = nullptr;
+  if (f.fdout > 1) {
+    const int fd = f.fdout;
+    f.fdout = -1;
+    if (close (fd) < 0)
+      return fail ("close", outpath);
+  }
+  return total;
+}
+
+static void
+chacha_file_tests (const std::array<uint8_t, 32> &key)
+{
+  const size_t N = 70 * 1024 * 1024 + 12345; // several chunks and a partial block
+  std::string tmpl = (getenv ("TMPDIR") ? getenv ("TMPDIR") : "/tmp") + std::string ("/chacha-XXXXXX");
+  std::string paths[3];
+  for (auto &path : paths) {
+    std::vector<char> name (tmpl.begin(), tmpl.end());
+    name.push_back (0);
+    const int fd = mkstemp (name.data());
+    assert (fd >= 0);
+    close (fd);
+    path = name.data();
+  }
+  std::vector<uint8_t> plain (N), data;
+  for (size_t i = 0; i < N; i++)
+    plain[i] = i * 0x9E3779B1 >> 24;
+  auto slurp = [] (const std::string &path) {
+    std::vector<uint8_t> v;
+    FILE *f = fopen (path.c_str(), "rb");
+    assert (f);
+    uint8_t buf[65536];
+    for (size_t n; (n = fread (buf, 1, sizeof (buf), f)) > 0; )
+      v.insert (v.end(), buf, buf + n);
+    fclose (f);
+    return v;
+  };
+  auto spill = [] (const std::string &path, const uint8_t *d, size_t n) {
+    FILE *f = fopen (path.c_str(), "wb");
+    assert (f && fwrite (d, 1, n, f) == n);
+    fclose (f);
+  };
+  spill (paths[0], plain.data(), N);
+  // mapped encryption yields RFC 8439 sealed chunks under the header nonce and the chunk index
+  const size_t nchunks = file_chunks (N);
+  assert (nchunks == 3);
+  assert (crypt_file (paths[0].c_str(), paths[1].c_str(), key, false, 3) == int64_t (N));
+  data = slurp (paths[1]);
+  assert (data.size() == FILE_HEADER + N + nchunks * FILE_TAG && memcmp (data.data(), FILE_MAGIC, 8) == 0);
+  uint64_t nonce;
+  memcpy (&nonce, &data[8], 8);
+  std::vector<uint8_t> chunk (FILE_CHUNK);
+  for (size_t k = 0; k < nchunks; k++) {
+    const size_t n = std::min (FILE_CHUNK, N - k * FILE_CHUNK);
+    const uint8_t *c = &data[FILE_HEADER + k * (FILE_CHUNK + FILE_TAG)];
+    std::array<uint8_t, 12> chunk_nonce;
+    memcpy (&chunk_nonce[0], &nonce, 8);
+    ChaCha::Alu::store32 (&chunk_nonce[8], k);
+    const uint8_t last = k + 1 == nchunks;
+    assert (ChaCha::open (key, chunk_nonce, &last, 1, c, n, chunk.data(), c + n));
+    assert (memcmp (chunk.data(), &plain[k * FILE_CHUNK], n) == 0);
+  }
+  // streamed encryption produces the same chunks
+  int fdin = open (paths[0].c_str(), O_RDONLY), fdout = open (paths[2].c_str(), O_WRONLY | O_TRUNC);
+  assert (fdin >= 0 && fdout >= 0);
+  uint64_t total = 0;
+  assert (crypt_streamed (key, nonce, false, fdin, fdout, 2, &total) && total == N);
+  close (fdin);
+  close (fdout);
+  assert (slurp (paths[2]) == std::vector<uint8_t> (data.begin() + FILE_HEADER, data.end()));
+  // mapped decryption
+  assert (crypt_file (paths[1].c_str(), paths[2].c_str(), key, true, 2) == int64_t (N));
+  assert (slurp (paths[2]) == plain);
+  // a rejected header leaves an existing output untouched
+  assert (crypt_file (paths[0].c_str(), paths[2].c_str(), key, true, 1) == -1);
+  assert (slurp (paths[2]) == plain);
+  // streamed decryption
+  fdin = open (paths[1].c_str(), O_RDONLY);
+  fdout = open (paths[2].c_str(), O_WRONLY | O_TRUNC);
+  assert (fdin >= 0 && fdout >= 0 && lseek (fdin, FILE_HEADER, SEEK_SET) == FILE_HEADER);
+  total = 0;
+  assert (crypt_streamed (key, nonce, true, fdin, fdout, 2, &total) && total == N);
+  close (fdin);
+  close (fdout);
+  assert (slurp (paths[2]) == plain);
+  // a modified chunk fails to open and empties the output
+  data[FILE_HEADER + FILE_CHUNK + FILE_TAG + 4711] ^= 1;
+  spill (paths[1], data.data(), data.size());
+  assert (crypt_file (paths[1].c_str(), paths[2].c_str(), key, true, 2) == -1);
+  assert (slurp (paths[2]).empty());
+  fdin = open (paths[1].c_str(), O_RDONLY);
+  fdout = open (paths[2].c_str(), O_WRONLY | O_TRUNC);
+  assert (fdin >= 0 && fdout >= 0 && lseek (fdin, FILE_HEADER, SEEK_SET) == FILE_HEADER);
+  total = 0;
+  assert (!crypt_streamed (key, nonce, true, fdin, fdout, 1, &total) && errno == EBADMSG && total == FILE_CHUNK);
+  close (fdin);
+  close (fdout);
+  data[FILE_HEADER + FILE_CHUNK + FILE_TAG + 4711] ^= 1;
+  // dropping the last chunk fails, the second chunk is not marked as the last one
+  spill (paths[1], data.data(), FILE_HEADER + 2 * (FILE_CHUNK + FILE_TAG));
+  assert (crypt_file (paths[1].c_str(), paths[2].c_str(), key, true, 2) == -1);
+  // a truncated tag fails
+  spill (paths[1], data.data(), data.size() - 1);
+  assert (crypt_file (paths[1].c_str(), paths[2].c_str(), key, true, 2) == -1);
+  // empty files hold a single sealed chunk
+  spill (paths[0], nullptr, 0);
+  assert (crypt_file (paths[0].c_str(), paths[1].c_str(), key, false, 2) == 0);
+  assert (slurp (paths[1]).size() == FILE_HEADER + FILE_TAG);
+  assert (crypt_file (paths[1].c_str(), paths[2].c_str(), key, true, 2) == 0);
+  assert (slurp (paths[2]).empty());
+  spill (paths[1], data.data(), FILE_HEADER);
+  assert (crypt_file (paths[1].c_str(), paths[2].c_str(), key, true, 2) == -1);
+  // key files hold exactly 64 hex digits
+  const char *hex = "000102030405060708090a0b0c0d0e0f101112131415161718191A1B1C1D1E1F";
+  std::array<uint8_t, 32> k;
+  auto key_file = [&] (const std::string &text) {
+    spill (paths[0], (const uint8_t*) text.data(), text.size());
+    k.fill (0xff);
+    return read_key_file (paths[0].c_str(), k);
+  };
+  assert (key_file (hex) && k[0] == 0x00 && k[15] == 0x0f && k[26] == 0x1a && k[31] == 0x1f);
+  assert (key_file (hex + std::string ("\n")) && k[31] == 0x1f);
+  assert (!key_file (hex + std::string ("0")));
+  assert (!key_file (hex + std::string ("\n\n")));
+  assert (!key_file (std::string (hex, 63)));
+  assert (!key_file (" " + std::string (hex, 63)));
+  assert (!key_file ("+" + std::string (hex + 1)));
+  assert (!key_file (std::string (hex, 62) + "xf"));
+  assert (!read_key_file (paths[2].c_str(), k)); // empty
+  for (auto &path : paths)
+    unlink (path.c_str());
+  assert (!read_key_file (paths[0].c_str(), k));
+  printf ("  OK    ChaCha-Poly1305 file encryption with mmap and streaming round trips\n");
+  printf ("  OK    ChaCha-Poly1305 file encryption rejects modified and truncated chunks\n");
+}
+
+static void
+chacha_threaded_tests (uint64_t nonce, const std::array<uint8_t, 32> &key)
+{
+  constexpr size_t T = 3, CHUNK = 64 * 17, NCHUNKS = 40;
+  char *mem[2] = { nullptr, nullptr };
+  size_t memsize[2] = { 0, 0 };
+  FILE *fmem = open_memstream (&mem[0], &memsize[0]);
+  const size_t total = generate_counter_ranges (nonce, key, NCHUNKS * CHUNK, 20, ~0, T, CHUNK, fmem);
+  fclose (fmem);
+  assert (total == NCHUNKS * CHUNK && memsize[0] == total);
+  fmem = open_memstream (&mem[1], &memsize[1]);
+  generate_bytes (nonce, key, NCHUNKS * CHUNK, 20, 1, 0, fmem);
+  fclose (fmem);
+  assert (memsize[1] >= total);
+  assert (0 == memcmp (mem[0], mem[1], total));
+  free (mem[0]);
+  free (mem[1]);
+  printf ("  OK    ChaCha counter ranges from %zu threads match the keystream\n", T);
+}
+
 int
 main (int argc, const char *argv[])
 {
@@ -37,10 +804,23 @@ main (int argc, const char *argv[])
 
   double streamlen = 0;
   unsigned kind = ~0; // ALU
+  unsigned threads = 0; // generate in the calling thread
+  bool bench_nt = false, decrypt = false;
+  const char *crypt_in = nullptr, *crypt_out = nullptr, *key_file = nullptr;
   for (int i = 1; i < argc; i++)
     if (0 == strcasecmp (argv[i], "--check")) {
       chacha_tests();
       chacha_stream_tests (nonce, key);
+      chacha_seek_tests (nonce, key);
+      chacha_stream_context_tests (nonce, key);
+      chacha_many_tests();
+      chacha_rng_tests (key);
+      chacha_rng_ring_tests (key);
+      poly1305_tests();
+      xchacha_tests();
+      aead_tests();
+      chacha_threaded_tests (nonce, key);
+      chacha_file_tests (key);
       return 0;
     } else if (0 == strcasecmp (argv[i], "--sse"))
       kind = 2; // SSE
@@ -48,6 +828,18 @@ main (int argc, const char *argv[])
       kind = 1; // ALU
     else if (0 == strcasecmp (argv[i], "--avx"))
       kind = 4; // AVX2
+    else if (0 == strcasecmp (argv[i], "--avx512"))
+      kind = 8; // AVX512
+    else if (0 == strcasecmp (argv[i], "--threads") && i+1 < argc)
+      threads = std::max (1ul, strtoul (argv[++i], nullptr, 0));
+    else if ((0 == strcmp (argv[i], "--encrypt") || 0 == strcmp (argv[i], "--decrypt")) && i+2 < argc) {
+      decrypt = 0 == strcmp (argv[i], "--decrypt");
+      crypt_in = argv[++i];
+      crypt_out = argv[++i];
+    } else if (0 == strcmp (argv[i], "--key-file") && i+1 < argc)
+      key_file = argv[++i];
+    else if (0 == strcasecmp (argv[i], "--bench-nt"))
+      bench_nt = true;
     else if (0 == strcasecmp (argv[i], "--seed") && i+1 < argc) {
       nonce = strtoull (argv[++i], nullptr, 0);
       key = std::array<uint8_t, 32>{};
@@ -65,16 +857,59 @@ main (int argc, const char *argv[])
           }
     }
 
-  if (streamlen > 0) {
+  if (crypt_in) {
+    if (!key_file) {
+      dprintf (2, "%s: --encrypt and --decrypt need --key-file\n", argv[0]);
+      return 1;
+    }
+    if (0 == strcmp (key_file, "-") && 0 == strcmp (crypt_in, "-")) {
+      dprintf (2, "%s: --key-file - needs an input file other than stdin\n", argv[0]);
+      return 1;
+    }
+    if (!read_key_file (key_file, key))
+      return 1;
+    const unsigned nthreads = threads ? threads : std::max (1u, std::thread::hardware_concurrency());
+    auto t1 = timestamp_nsecs();
+    const int64_t total = crypt_file (crypt_in, crypt_out, key, decrypt, nthreads);
+    auto t2 = timestamp_nsecs();
+    ChaCha::secure_zero (key.data(), key.size());
+    if (total < 0)
+      return 1;
+    dprintf (2, "%s: %.3f msecs (%lld Bytes), %f GB/sec with %u threads\n", decrypt ? "decrypt" : "encrypt", (t2 - t1) / 1000000.0,
+             (long long) total, total * (1000000000.0 / (1024*1024*1024)) / (t2 - t1), nthreads);
+    return 0;
+  }
+  if (bench_nt) {
+#if defined(__AVX2__)
+    std::array<uint32_t, 16> state;
+    ChaCha::key_setup (state, 256, key, nonce);
+    dprintf (2, "BENCH: ChaCha8 AVX2 fills with regular and non-temporal stores\n");
+    llc_consumer_bench ("avx2_block()", [&] (uint8_t *buf, size_t n) {
+      for (size_t i = 0; i < n; i += 64 * ChaCha::avx_blocks)
+        ChaCha::avx2_block (state, nullptr, buf + i, 8);
+    });
+    llc_consumer_bench ("avx2_block<true>()", [&] (uint8_t *buf, size_t n) { ChaCha::generate_blocks_stream (state, n, buf, 8); });
+    llc_consumer_bench ("avx2_block<true>() unaligned", [&] (uint8_t *buf, size_t n) { ChaCha::generate_blocks_stream (state, n - 64, buf + 16, 8); });
+#endif
+  }
+  else if (streamlen > 0) {
     streamlen = std::min (streamlen, 0x1p+63); // 2^63 = 9223372036854775808
     dprintf (2, "BENCH: %zu Bytes\n", size_t (streamlen));
     auto t1 = timestamp_nsecs();
-    const size_t total = generate_bytes (nonce, key, uint64_t (streamlen), 8, kind, nullptr);
+    const size_t total = generate_bytes (nonce, key, uint64_t (streamlen), 8, kind, threads, nullptr);
     auto t2 = timestamp_nsecs();
     dprintf (2, " %.3f msecs (%zu Bytes), %f GB/sec\n", (t2 - t1) / 1000000.0, total, total * (1000000000.0 / (1024*1024*1024)) / (t2 - t1));
+    aead_bench (key, std::min (uint64_t (streamlen), uint64_t (1) << 30));
+    hchacha_bench (key);
+    range_bench (nonce, key);
+    packet_bench (nonce, key);
+    many_bench (nonce);
+    rounds_bench (nonce, key);
+    rng_bench (key);
+    rng_ring_bench (key);
   }
   else
-    generate_bytes (nonce, key, ~uint64_t (0), 8, kind, stdout);
+    generate_bytes (nonce, key, ~uint64_t (0), 8, kind, threads, stdout);
 
   return 0;
 }
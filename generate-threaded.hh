@@ -0,0 +1,68 @@
+// Dedicated to the Public Domain under the Unlicense: https://unlicense.org/UNLICENSE
+
+#ifndef __GENERATE_THREADED_HH__
+#define __GENERATE_THREADED_HH__
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+/** Generate `nbytes` in `chunk` sized pieces on a pool of `nthreads` workers and write them to `fout` in order.
+ * `make_worker (w)` creates the chunk generator for worker `w`, which is called as `gen (k, dest)` for every
+ * chunk `k` with `k % nthreads == w` in increasing order. Each worker double buffers its chunks, the
+ * caller reassembles them round-robin, so the output only depends on the seed, `chunk` and `nthreads`.
+ */
+template<class MakeWorker> static uint64_t
+generate_threaded (const unsigned nthreads, const uint64_t nbytes, const size_t chunk, FILE *fout, const MakeWorker &make_worker)
+{
+  struct Worker {
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::vector<uint8_t> slots[2];
+    bool full[2] = { false, false };
+    std::thread thread;
+  };
+  const uint64_t nchunks = nbytes / chunk + (nbytes % chunk != 0);
+  std::vector<Worker> workers (nthreads);
+  for (unsigned w = 0; w < nthreads; w++) {
+    Worker &wk = workers[w];
+    wk.thread = std::thread ([&wk, w, nthreads, nchunks, chunk, gen = make_worker (w)] () mutable {
+      for (uint64_t k = w, j = 0; k < nchunks; k += nthreads, j ^= 1) {
+        {
+          std::unique_lock<std::mutex> lock (wk.mutex);
+          wk.cond.wait (lock, [&] { return !wk.full[j]; });
+        }
+        wk.slots[j].resize (chunk);
+        gen (k, wk.slots[j].data());
+        {
+          std::lock_guard<std::mutex> lock (wk.mutex);
+          wk.full[j] = true;
+        }
+        wk.cond.notify_all();
+      }
+    });
+  }
+  for (uint64_t k = 0; k < nchunks; k++) {
+    Worker &wk = workers[k % nthreads];
+    const size_t j = (k / nthreads) & 1;
+    {
+      std::unique_lock<std::mutex> lock (wk.mutex);
+      wk.cond.wait (lock, [&] { return wk.full[j]; });
+    }
+    if (fout)
+      fwrite (wk.slots[j].data(), chunk, 1, fout);
+    {
+      std::lock_guard<std::mutex> lock (wk.mutex);
+      wk.full[j] = false;
+    }
+    wk.cond.notify_all();
+  }
+  for (auto &wk : workers)
+    wk.thread.join();
+  return nchunks * chunk;
+}
+
+#endif // __GENERATE_THREADED_HH__
@@ -4,6 +4,9 @@
 #define __KECCAK_HH__
 
 #include <limits>
+#if defined(__x86_64__)
+#  include <immintrin.h>
+#endif // __x86_64__
 
 namespace scl::Keccak {
 
@@ -16,6 +19,7 @@ extern inline void keccak1600_permute (std::array<uint64_t,25>&, uint32_t);
  * KeccakCryptoRng, KeccakGoodRng and KeccakFastRng.
  */
 class KeccakRng {
+  friend class KeccakRngX4;
   const uint16_t          bit_rate_, n_rounds_;
   uint32_t                opos_ = 0;
   union {
@@ -237,43 +241,45 @@ KeccakRng::update64 (const uint64_t *seeds, size_t n_seeds, bool finalize)
 #endif
 }
 
-/// The Keccak-f[1600] permutation for up to 254 rounds, see http://keccak.noekeon.org/Keccak-reference-3.0.pdf.
-extern inline void
-keccak1600_permute (std::array<uint64_t,25> &A, const uint32_t n_rounds)
+/// Keccak-f[1600] round constants, extended to 255 rounds.
+static constexpr const uint64_t KECCAK_ROUND_CONSTANTS[255] = {
+  1, 32898, 0x800000000000808a, 0x8000000080008000, 32907, 0x80000001, 0x8000000080008081, 0x8000000000008009, 138, 136, 0x80008009,
+  0x8000000a, 0x8000808b, 0x800000000000008b, 0x8000000000008089, 0x8000000000008003, 0x8000000000008002, 0x8000000000000080, 32778,
+  0x800000008000000a, 0x8000000080008081, 0x8000000000008080, 0x80000001, 0x8000000080008008, 0x8000000080008082, 0x800000008000800a,
+  0x8000000000000003, 0x8000000080000009, 0x8000000000008082, 32777, 0x8000000000000080, 32899, 0x8000000000000081, 1, 32779,
+  0x8000000080008001, 128, 0x8000000000008000, 0x8000000080008001, 9, 0x800000008000808b, 129, 0x8000000000000082, 0x8000008b,
+  0x8000000080008009, 0x8000000080000000, 0x80000080, 0x80008003, 0x8000000080008082, 0x8000000080008083, 0x8000000080000088, 32905,
+  32777, 0x8000000000000009, 0x80008008, 0x80008001, 0x800000000000008a, 0x800000000000000b, 137, 0x80000002, 0x800000000000800b,
+  0x8000800b, 32907, 0x80000088, 0x800000000000800a, 0x80000089, 0x8000000000000001, 0x8000000000008088, 0x8000000000000081, 136,
+  0x80008080, 129, 0x800000000000000b, 0, 137, 0x8000008b, 0x8000000080008080, 0x800000000000008b, 0x8000000000008000,
+  0x8000000080008088, 0x80000082, 11, 0x800000000000000a, 32898, 0x8000000000008003, 0x800000000000808b, 0x800000008000000b,
+  0x800000008000008a, 0x80000081, 0x80000081, 0x80000008, 131, 0x8000000080008003, 0x80008088, 0x8000000080000088, 32768, 0x80008082,
+  0x80008089, 0x8000000080008083, 0x8000000080000001, 0x80008002, 0x8000000080000089, 130, 0x8000000080000008, 0x8000000000000089,
+  0x8000000080000008, 0x8000000000000000, 0x8000000000000083, 0x80008080, 8, 0x8000000080000080, 0x8000000080008080,
+  0x8000000000000002, 0x800000008000808b, 8, 0x8000000080000009, 0x800000000000800b, 0x80008082, 0x80008000, 0x8000000000008008, 32897,
+  0x8000000080008089, 0x80008089, 0x800000008000800a, 0x800000000000008a, 0x8000000000000082, 0x80000002, 0x8000000000008082, 32896,
+  0x800000008000000b, 0x8000000080000003, 10, 0x8000000000008001, 0x8000000080000083, 0x8000000000008083, 139, 32778,
+  0x8000000080000083, 0x800000000000800a, 0x80000000, 0x800000008000008a, 0x80000008, 10, 0x8000000000008088, 0x8000000000000008,
+  0x80000003, 0x8000000000000000, 0x800000000000000a, 32779, 0x8000000080008088, 0x8000000b, 0x80000080, 0x8000808a,
+  0x8000000000008009, 3, 0x80000003, 0x8000000000000089, 0x8000000080000081, 0x800000008000008b, 0x80008003, 0x800000008000800b,
+  0x8000000000008008, 32776, 0x8000000000008002, 0x8000000000000009, 0x80008081, 32906, 0x8000800a, 128, 0x8000000000008089,
+  0x800000000000808a, 0x8000000080008089, 0x80008000, 0x8000000000008081, 0x8000800a, 9, 0x8000000080008002, 0x8000000a, 0x80008002,
+  0x8000000080000000, 0x80000009, 32904, 2, 0x80008008, 0x80008088, 0x8000000080000001, 0x8000808b, 0x8000000000000002,
+  0x8000000080008002, 0x80000083, 32905, 32896, 0x8000000080000082, 0x8000000000000088, 0x800000008000808a, 32906, 0x80008083,
+  0x8000000b, 0x80000009, 32769, 0x80000089, 0x8000000000000088, 0x8000000080008003, 0x80008001, 0x8000000000000003,
+  0x8000000080000080, 0x8000000080008009, 0x8000000080000089, 11, 0x8000000000000083, 0x80008009, 0x80000083, 32768, 0x8000800b, 32770,
+  3, 0x8000008a, 0x8000000080000002, 32769, 0x80000000, 0x8000000080000003, 131, 0x800000008000808a, 32771, 32776, 0x800000000000808b,
+  0x8000000080000082, 0x8000000000000001, 0x8000000000008001, 0x800000008000000a, 0x8000000080008008, 0x800000008000800b,
+  0x8000000000008081, 0x80008083, 0x80000082, 130, 0x8000000080000081, 0x8000000080000002, 32904, 139, 32899, 0x8000000000000008,
+  0x8000008a, 0x800000008000008b, 0x8000808a, 0x8000000000008080, 0x80000088, 0x8000000000008083, 2, 0x80008081, 32771, 32897,
+  0x8000000080008000, 32770, 138,
+};
+
+/// Reference Keccak-f[1600] permutation for up to 254 rounds, see http://keccak.noekeon.org/Keccak-reference-3.0.pdf.
+static inline void
+keccak1600_permute_ref (std::array<uint64_t,25> &A, const uint32_t n_rounds)
 {
   assert (n_rounds < 255);
-  static constexpr const uint64_t KECCAK_ROUND_CONSTANTS[255] = {
-    1, 32898, 0x800000000000808a, 0x8000000080008000, 32907, 0x80000001, 0x8000000080008081, 0x8000000000008009, 138, 136, 0x80008009,
-    0x8000000a, 0x8000808b, 0x800000000000008b, 0x8000000000008089, 0x8000000000008003, 0x8000000000008002, 0x8000000000000080, 32778,
-    0x800000008000000a, 0x8000000080008081, 0x8000000000008080, 0x80000001, 0x8000000080008008, 0x8000000080008082, 0x800000008000800a,
-    0x8000000000000003, 0x8000000080000009, 0x8000000000008082, 32777, 0x8000000000000080, 32899, 0x8000000000000081, 1, 32779,
-    0x8000000080008001, 128, 0x8000000000008000, 0x8000000080008001, 9, 0x800000008000808b, 129, 0x8000000000000082, 0x8000008b,
-    0x8000000080008009, 0x8000000080000000, 0x80000080, 0x80008003, 0x8000000080008082, 0x8000000080008083, 0x8000000080000088, 32905,
-    32777, 0x8000000000000009, 0x80008008, 0x80008001, 0x800000000000008a, 0x800000000000000b, 137, 0x80000002, 0x800000000000800b,
-    0x8000800b, 32907, 0x80000088, 0x800000000000800a, 0x80000089, 0x8000000000000001, 0x8000000000008088, 0x8000000000000081, 136,
-    0x80008080, 129, 0x800000000000000b, 0, 137, 0x8000008b, 0x8000000080008080, 0x800000000000008b, 0x8000000000008000,
-    0x8000000080008088, 0x80000082, 11, 0x800000000000000a, 32898, 0x8000000000008003, 0x800000000000808b, 0x800000008000000b,
-    0x800000008000008a, 0x80000081, 0x80000081, 0x80000008, 131, 0x8000000080008003, 0x80008088, 0x8000000080000088, 32768, 0x80008082,
-    0x80008089, 0x8000000080008083, 0x8000000080000001, 0x80008002, 0x8000000080000089, 130, 0x8000000080000008, 0x8000000000000089,
-    0x8000000080000008, 0x8000000000000000, 0x8000000000000083, 0x80008080, 8, 0x8000000080000080, 0x8000000080008080,
-    0x8000000000000002, 0x800000008000808b, 8, 0x8000000080000009, 0x800000000000800b, 0x80008082, 0x80008000, 0x8000000000008008, 32897,
-    0x8000000080008089, 0x80008089, 0x800000008000800a, 0x800000000000008a, 0x8000000000000082, 0x80000002, 0x8000000000008082, 32896,
-    0x800000008000000b, 0x8000000080000003, 10, 0x8000000000008001, 0x8000000080000083, 0x8000000000008083, 139, 32778,
-    0x8000000080000083, 0x800000000000800a, 0x80000000, 0x800000008000008a, 0x80000008, 10, 0x8000000000008088, 0x8000000000000008,
-    0x80000003, 0x8000000000000000, 0x800000000000000a, 32779, 0x8000000080008088, 0x8000000b, 0x80000080, 0x8000808a,
-    0x8000000000008009, 3, 0x80000003, 0x8000000000000089, 0x8000000080000081, 0x800000008000008b, 0x80008003, 0x800000008000800b,
-    0x8000000000008008, 32776, 0x8000000000008002, 0x8000000000000009, 0x80008081, 32906, 0x8000800a, 128, 0x8000000000008089,
-    0x800000000000808a, 0x8000000080008089, 0x80008000, 0x8000000000008081, 0x8000800a, 9, 0x8000000080008002, 0x8000000a, 0x80008002,
-    0x8000000080000000, 0x80000009, 32904, 2, 0x80008008, 0x80008088, 0x8000000080000001, 0x8000808b, 0x8000000000000002,
-    0x8000000080008002, 0x80000083, 32905, 32896, 0x8000000080000082, 0x8000000000000088, 0x800000008000808a, 32906, 0x80008083,
-    0x8000000b, 0x80000009, 32769, 0x80000089, 0x8000000000000088, 0x8000000080008003, 0x80008001, 0x8000000000000003,
-    0x8000000080000080, 0x8000000080008009, 0x8000000080000089, 11, 0x8000000000000083, 0x80008009, 0x80000083, 32768, 0x8000800b, 32770,
-    3, 0x8000008a, 0x8000000080000002, 32769, 0x80000000, 0x8000000080000003, 131, 0x800000008000808a, 32771, 32776, 0x800000000000808b,
-    0x8000000080000082, 0x8000000000000001, 0x8000000000008001, 0x800000008000000a, 0x8000000080008008, 0x800000008000800b,
-    0x8000000000008081, 0x80008083, 0x80000082, 130, 0x8000000080000081, 0x8000000080000002, 32904, 139, 32899, 0x8000000000000008,
-    0x8000008a, 0x800000008000008b, 0x8000808a, 0x8000000000008080, 0x80000088, 0x8000000000008083, 2, 0x80008081, 32771, 32897,
-    0x8000000080008000, 32770, 138,
-  };
   static constexpr const uint8_t KECCAK_RHO_OFFSETS[25] = { 0, 1, 62, 28, 27, 36, 44, 6, 55, 20, 3, 10, 43,
                                                             25, 39, 41, 45, 15, 21, 8, 18, 2, 61, 56, 14 };
   const auto bit_rotate64 = [] (uint64_t bits, unsigned int offset) -> uint64_t {
@@ -330,6 +336,560 @@ keccak1600_permute (std::array<uint64_t,25> &A, const uint32_t n_rounds)
     }
 }
 
+/// Rotate left by a constant `N` in 1..63, compiles to a single rol instruction.
+template<unsigned N> static inline uint64_t
+rol64 (uint64_t bits)
+{
+  return (bits << N) | (bits >> (64 - N));
+}
+
+/** One Keccak-f[1600] round from `A` into `E` with theta, rho, pi, chi and iota fused per output plane.
+ * With COMPLEMENT, the lanes at KECCAK_COMPLEMENTED are kept inverted, which turns all but one NOT per plane
+ * of chi into AND/OR variants, see "Keccak implementation overview" section 2.2, lane complementing transform.
+ * Without COMPLEMENT, chi uses `~b & c` directly, which is a single andn instruction with BMI1.
+ */
+template<bool COMPLEMENT> static inline void
+keccak1600_round (const uint64_t *A, uint64_t *E, const uint64_t round_constant)
+{
+  // theta
+  const uint64_t C0 = A[0] ^ A[5] ^ A[10] ^ A[15] ^ A[20];
+  const uint64_t C1 = A[1] ^ A[6] ^ A[11] ^ A[16] ^ A[21];
+  const uint64_t C2 = A[2] ^ A[7] ^ A[12] ^ A[17] ^ A[22];
+  const uint64_t C3 = A[3] ^ A[8] ^ A[13] ^ A[18] ^ A[23];
+  const uint64_t C4 = A[4] ^ A[9] ^ A[14] ^ A[19] ^ A[24];
+  const uint64_t D0 = C4 ^ rol64<1> (C1);
+  const uint64_t D1 = C0 ^ rol64<1> (C2);
+  const uint64_t D2 = C1 ^ rol64<1> (C3);
+  const uint64_t D3 = C2 ^ rol64<1> (C4);
+  const uint64_t D4 = C3 ^ rol64<1> (C0);
+  uint64_t B0, B1, B2, B3, B4;
+  // plane 0, rho and pi gather lanes (0,0) (1,1) (2,2) (3,3) (4,4)
+  B0 = A[0] ^ D0;
+  B1 = rol64<44> (A[6] ^ D1);
+  B2 = rol64<43> (A[12] ^ D2);
+  B3 = rol64<21> (A[18] ^ D3);
+  B4 = rol64<14> (A[24] ^ D4);
+  if (COMPLEMENT) {
+    E[0] = B0 ^ (B1 | B2) ^ round_constant;
+    E[1] = B1 ^ (~B2 | B3);
+    E[2] = B2 ^ (B3 & B4);
+    E[3] = B3 ^ (B4 | B0);
+    E[4] = B4 ^ (B0 & B1);
+  } else {
+    E[0] = B0 ^ (~B1 & B2) ^ round_constant;
+    E[1] = B1 ^ (~B2 & B3);
+    E[2] = B2 ^ (~B3 & B4);
+    E[3] = B3 ^ (~B4 & B0);
+    E[4] = B4 ^ (~B0 & B1);
+  }
+  // plane 1, lanes (3,0) (4,1) (0,2) (1,3) (2,4)
+  B0 = rol64<28> (A[3] ^ D3);
+  B1 = rol64<20> (A[9] ^ D4);
+  B2 = rol64<3>  (A[10] ^ D0);
+  B3 = rol64<45> (A[16] ^ D1);
+  B4 = rol64<61> (A[22] ^ D2);
+  if (COMPLEMENT) {
+    E[5] = B0 ^ (B1 | B2);
+    E[6] = B1 ^ (B2 & B3);
+    E[7] = B2 ^ (B3 | ~B4);
+    E[8] = B3 ^ (B4 | B0);
+    E[9] = B4 ^ (B0 & B1);
+  } else {
+    E[5] = B0 ^ (~B1 & B2);
+    E[6] = B1 ^ (~B2 & B3);
+    E[7] = B2 ^ (~B3 & B4);
+    E[8] = B3 ^ (~B4 & B0);
+    E[9] = B4 ^ (~B0 & B1);
+  }
+  // plane 2, lanes (1,0) (2,1) (3,2) (4,3) (0,4)
+  B0 = rol64<1>  (A[1] ^ D1);
+  B1 = rol64<6>  (A[7] ^ D2);
+  B2 = rol64<25> (A[13] ^ D3);
+  B3 = rol64<8>  (A[19] ^ D4);
+  B4 = rol64<18> (A[20] ^ D0);
+  if (COMPLEMENT) {
+    E[10] = B0 ^ (B1 | B2);
+    E[11] = B1 ^ (B2 & B3);
+    E[12] = B2 ^ (~B3 & B4);
+    E[13] = ~B3 ^ (B4 | B0);
+    E[14] = B4 ^ (B0 & B1);
+  } else {
+    E[10] = B0 ^ (~B1 & B2);
+    E[11] = B1 ^ (~B2 & B3);
+    E[12] = B2 ^ (~B3 & B4);
+    E[13] = B3 ^ (~B4 & B0);
+    E[14] = B4 ^ (~B0 & B1);
+  }
+  // plane 3, lanes (4,0) (0,1) (1,2) (2,3) (3,4)
+  B0 = rol64<27> (A[4] ^ D4);
+  B1 = rol64<36> (A[5] ^ D0);
+  B2 = rol64<10> (A[11] ^ D1);
+  B3 = rol64<15> (A[17] ^ D2);
+  B4 = rol64<56> (A[23] ^ D3);
+  if (COMPLEMENT) {
+    E[15] = B0 ^ (B1 & B2);
+    E[16] = B1 ^ (B2 | B3);
+    E[17] = B2 ^ (~B3 | B4);
+    E[18] = ~B3 ^ (B4 & B0);
+    E[19] = B4 ^ (B0 | B1);
+  } else {
+    E[15] = B0 ^ (~B1 & B2);
+    E[16] = B1 ^ (~B2 & B3);
+    E[17] = B2 ^ (~B3 & B4);
+    E[18] = B3 ^ (~B4 & B0);
+    E[19] = B4 ^ (~B0 & B1);
+  }
+  // plane 4, lanes (2,0) (3,1) (4,2) (0,3) (1,4)
+  B0 = rol64<62> (A[2] ^ D2);
+  B1 = rol64<55> (A[8] ^ D3);
+  B2 = rol64<39> (A[14] ^ D4);
+  B3 = rol64<41> (A[15] ^ D0);
+  B4 = rol64<2>  (A[21] ^ D1);
+  if (COMPLEMENT) {
+    E[20] = B0 ^ (~B1 & B2);
+    E[21] = ~B1 ^ (B2 | B3);
+    E[22] = B2 ^ (B3 & B4);
+    E[23] = B3 ^ (B4 | B0);
+    E[24] = B4 ^ (B0 & B1);
+  } else {
+    E[20] = B0 ^ (~B1 & B2);
+    E[21] = B1 ^ (~B2 & B3);
+    E[22] = B2 ^ (~B3 & B4);
+    E[23] = B3 ^ (~B4 & B0);
+    E[24] = B4 ^ (~B0 & B1);
+  }
+}
+
+/// Lanes that are kept complemented by keccak1600_round<true>().
+static constexpr const uint8_t KECCAK_COMPLEMENTED[6] = { 1, 2, 8, 12, 17, 20 };
+
+/// Unrolled Keccak-f[1600] permutation for up to 254 rounds, the state lives in locals and two rounds run per iteration.
+template<bool COMPLEMENT> static inline void
+keccak1600_permute_unrolled (std::array<uint64_t,25> &state, const uint32_t n_rounds)
+{
+  assert (n_rounds < 255);
+  uint64_t A[25], E[25];
+  for (size_t i = 0; i < 25; i++)
+    A[i] = state[i];
+  if (COMPLEMENT)
+    for (auto i : KECCAK_COMPLEMENTED)
+      A[i] = ~A[i];
+  uint32_t r = 0;
+  for (; r + 2 <= n_rounds; r += 2) {
+    keccak1600_round<COMPLEMENT> (A, E, KECCAK_ROUND_CONSTANTS[r]);
+    keccak1600_round<COMPLEMENT> (E, A, KECCAK_ROUND_CONSTANTS[r + 1]);
+  }
+  if (r < n_rounds) {
+    keccak1600_round<COMPLEMENT> (A, E, KECCAK_ROUND_CONSTANTS[r]);
+    for (size_t i = 0; i < 25; i++)
+      A[i] = E[i];
+  }
+  if (COMPLEMENT)
+    for (auto i : KECCAK_COMPLEMENTED)
+      A[i] = ~A[i];
+  for (size_t i = 0; i < 25; i++)
+    state[i] = A[i];
+}
+
+/** The Keccak-f[1600] permutation for up to 254 rounds.
+ * Uses the unrolled permutation, with andn based chi if BMI1 is available and lane complementing otherwise.
+ * Define KECCAK_REFERENCE to use keccak1600_permute_ref() instead.
+ */
+extern inline void
+keccak1600_permute (std::array<uint64_t,25> &A, const uint32_t n_rounds)
+{
+#if defined(KECCAK_REFERENCE)
+  keccak1600_permute_ref (A, n_rounds);
+#elif defined(__BMI__)
+  keccak1600_permute_unrolled<false> (A, n_rounds);
+#else
+  keccak1600_permute_unrolled<true> (A, n_rounds);
+#endif
+}
+
+/// Chi of one plane of interleaved states, forced inline so the round stays one straight line block.
+template<class V, class Ops> static inline __attribute__ ((always_inline)) void
+keccak1600_chi_lanes (V *P, const V &B0, const V &B1, const V &B2, const V &B3, const V &B4)
+{
+  P[0] = Ops::Chi (B0, B1, B2);
+  P[1] = Ops::Chi (B1, B2, B3);
+  P[2] = Ops::Chi (B2, B3, B4);
+  P[3] = Ops::Chi (B3, B4, B0);
+  P[4] = Ops::Chi (B4, B0, B1);
+}
+
+/** One Keccak-f[1600] round over several interleaved states, one state per 64 bit vector lane.
+ * Same plane order as keccak1600_round<false>(), `Ops` provides Xor, Xor3, Chi (a ^ (~b & c)) and Rol<N>.
+ */
+template<class V, class Ops> static inline __attribute__ ((always_inline)) void
+keccak1600_round_lanes (const V *A, V *E, const V &round_constant)
+{
+  // theta
+  const V C0 = Ops::Xor3 (Ops::Xor3 (A[0], A[5], A[10]), A[15], A[20]);
+  const V C1 = Ops::Xor3 (Ops::Xor3 (A[1], A[6], A[11]), A[16], A[21]);
+  const V C2 = Ops::Xor3 (Ops::Xor3 (A[2], A[7], A[12]), A[17], A[22]);
+  const V C3 = Ops::Xor3 (Ops::Xor3 (A[3], A[8], A[13]), A[18], A[23]);
+  const V C4 = Ops::Xor3 (Ops::Xor3 (A[4], A[9], A[14]), A[19], A[24]);
+  const V D0 = Ops::Xor (C4, Ops::template Rol<1> (C1));
+  const V D1 = Ops::Xor (C0, Ops::template Rol<1> (C2));
+  const V D2 = Ops::Xor (C1, Ops::template Rol<1> (C3));
+  const V D3 = Ops::Xor (C2, Ops::template Rol<1> (C4));
+  const V D4 = Ops::Xor (C3, Ops::template Rol<1> (C0));
+  // rho, pi and chi per output plane
+  V B0, B1, B2, B3, B4;
+  B0 = Ops::Xor (A[0], D0);
+  B1 = Ops::template Rol<44> (Ops::Xor (A[6], D1));
+  B2 = Ops::template Rol<43> (Ops::Xor (A[12], D2));
+  B3 = Ops::template Rol<21> (Ops::Xor (A[18], D3));
+  B4 = Ops::template Rol<14> (Ops::Xor (A[24], D4));
+  keccak1600_chi_lanes<V, Ops> (&E[0], B0, B1, B2, B3, B4);
+  E[0] = Ops::Xor (E[0], round_constant);
+  B0 = Ops::template Rol<28> (Ops::Xor (A[3], D3));
+  B1 = Ops::template Rol<20> (Ops::Xor (A[9], D4));
+  B2 = Ops::template Rol<3>  (Ops::Xor (A[10], D0));
+  B3 = Ops::template Rol<45> (Ops::Xor (A[16], D1));
+  B4 = Ops::template Rol<61> (Ops::Xor (A[22], D2));
+  keccak1600_chi_lanes<V, Ops> (&E[5], B0, B1, B2, B3, B4);
+  B0 = Ops::template Rol<1>  (Ops::Xor (A[1], D1));
+  B1 = Ops::template Rol<6>  (Ops::Xor (A[7], D2));
+  B2 = Ops::template Rol<25> (Ops::Xor (A[13], D3));
+  B3 = Ops::template Rol<8>  (Ops::Xor (A[19], D4));
+  B4 = Ops::template Rol<18> (Ops::Xor (A[20], D0));
+  keccak1600_chi_lanes<V, Ops> (&E[10], B0, B1, B2, B3, B4);
+  B0 = Ops::template Rol<27> (Ops::Xor (A[4], D4));
+  B1 = Ops::template Rol<36> (Ops::Xor (A[5], D0));
+  B2 = Ops::template Rol<10> (Ops::Xor (A[11], D1));
+  B3 = Ops::template Rol<15> (Ops::Xor (A[17], D2));
+  B4 = Ops::template Rol<56> (Ops::Xor (A[23], D3));
+  keccak1600_chi_lanes<V, Ops> (&E[15], B0, B1, B2, B3, B4);
+  B0 = Ops::template Rol<62> (Ops::Xor (A[2], D2));
+  B1 = Ops::template Rol<55> (Ops::Xor (A[8], D3));
+  B2 = Ops::template Rol<39> (Ops::Xor (A[14], D4));
+  B3 = Ops::template Rol<41> (Ops::Xor (A[15], D0));
+  B4 = Ops::template Rol<2>  (Ops::Xor (A[21], D1));
+  keccak1600_chi_lanes<V, Ops> (&E[20], B0, B1, B2, B3, B4);
+}
+
+/// Permute the interleaved states `A[25][LANES]` with `Ops::Load` and `Ops::Store` of one lane row.
+template<class V, class Ops> static inline __attribute__ ((always_inline)) void
+keccak1600_permute_lanes (uint64_t *A, const uint32_t n_rounds)
+{
+  assert (n_rounds < 255);
+  constexpr size_t LANES = sizeof (V) / 8;
+  V S[25], E[25];
+  for (size_t i = 0; i < 25; i++)
+    S[i] = Ops::Load (A + LANES * i);
+  uint32_t r = 0;
+  for (; r + 2 <= n_rounds; r += 2) {
+    const V rc0 = Ops::Set1 (KECCAK_ROUND_CONSTANTS[r]), rc1 = Ops::Set1 (KECCAK_ROUND_CONSTANTS[r + 1]);
+    keccak1600_round_lanes<V, Ops> (S, E, rc0);
+    keccak1600_round_lanes<V, Ops> (E, S, rc1);
+  }
+  if (r < n_rounds) {
+    const V rc0 = Ops::Set1 (KECCAK_ROUND_CONSTANTS[r]);
+    keccak1600_round_lanes<V, Ops> (S, E, rc0);
+    for (size_t i = 0; i < 25; i++)
+      S[i] = E[i];
+  }
+  for (size_t i = 0; i < 25; i++)
+    Ops::Store (A + LANES * i, S[i]);
+}
+
+#if defined(__AVX2__)
+struct Avx2Ops {
+  static __m256i Load  (const uint64_t *p)        { return _mm256_loadu_si256 ((const __m256i*) p); }
+  static void    Store (uint64_t *p, __m256i v)   { _mm256_storeu_si256 ((__m256i*) p, v); }
+  static __m256i Set1  (uint64_t v)               { return _mm256_set1_epi64x (v); }
+  static __m256i Xor   (__m256i a, __m256i b)     { return _mm256_xor_si256 (a, b); }
+  static __m256i Xor3  (__m256i a, __m256i b, __m256i c) { return _mm256_xor_si256 (_mm256_xor_si256 (a, b), c); }
+  static __m256i Chi   (__m256i a, __m256i b, __m256i c) { return _mm256_xor_si256 (a, _mm256_andnot_si256 (b, c)); }
+  template<unsigned N> static __m256i
+  Rol (__m256i a)
+  {
+    return _mm256_or_si256 (_mm256_slli_epi64 (a, N), _mm256_srli_epi64 (a, 64 - N));
+  }
+};
+#endif // __AVX2__
+
+/** Keccak-f[1600] permutation of 4 independent states, interleaved as `A[4 * i + l]` = lane `i` of state `l`.
+ * Runs the states in the 4 lanes of AVX2 registers, or one after another without AVX2.
+ */
+extern inline void
+keccak1600_permute_x4 (std::array<uint64_t,100> &A, const uint32_t n_rounds)
+{
+#if defined(__AVX2__)
+  keccak1600_permute_lanes<__m256i, Avx2Ops> (A.data(), n_rounds);
+#else
+  for (size_t l = 0; l < 4; l++) {
+    std::array<uint64_t,25> state;
+    for (size_t i = 0; i < 25; i++)
+      state[i] = A[4 * i + l];
+    keccak1600_permute (state, n_rounds);
+    for (size_t i = 0; i < 25; i++)
+      A[4 * i + l] = state[i];
+  }
+#endif
+}
+
+// == AVX-512 ==
+// Compiled for AVX-512F regardless of -march and selected at runtime, see keccak1600_avx512_supported().
+#if defined(__x86_64__)
+#define KECCAK_AVX512_TARGET    __attribute__ ((target ("avx512f")))
+#define KECCAK_AVX512_INLINE    __attribute__ ((target ("avx512f"), always_inline)) inline
+#define KECCAK_HAVE_AVX512      1
+
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ == 12
+// Silence GCC-12 false positives about _mm512_undefined_epi32(), see https://gcc.gnu.org/PR105593
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#endif
+
+/// Runtime check for AVX-512F.
+static inline bool
+keccak1600_avx512_supported ()
+{
+  return __builtin_cpu_supports ("avx512f");
+}
+
+/// Chi of one plane of 8 interleaved states, a single vpternlogq (0xD2 = a ^ (~b & c)) per lane.
+KECCAK_AVX512_INLINE static void
+keccak1600_chi_x8 (__m512i *P, __m512i B0, __m512i B1, __m512i B2, __m512i B3, __m512i B4)
+{
+  P[0] = _mm512_ternarylogic_epi64 (B0, B1, B2, 0xD2);
+  P[1] = _mm512_ternarylogic_epi64 (B1, B2, B3, 0xD2);
+  P[2] = _mm512_ternarylogic_epi64 (B2, B3, B4, 0xD2);
+  P[3] = _mm512_ternarylogic_epi64 (B3, B4, B0, 0xD2);
+  P[4] = _mm512_ternarylogic_epi64 (B4, B0, B1, 0xD2);
+}
+
+/** One Keccak-f[1600] round of 8 interleaved states, as keccak1600_round_lanes() with theta folded into vpternlogq
+ * (0x96 = a ^ b ^ c) and rho using native vprolq. Written out for AVX-512 since the generic lane templates are not
+ * compiled for it, and would change the vector ABI of their helpers.
+ */
+KECCAK_AVX512_INLINE static void
+keccak1600_round_x8 (const __m512i *A, __m512i *E, __m512i round_constant)
+{
+
+  // theta
+  const __m512i C0 = _mm512_ternarylogic_epi64 (_mm512_ternarylogic_epi64 (A[0], A[5], A[10], 0x96), A[15], A[20], 0x96);
+  const __m512i C1 = _mm512_ternarylogic_epi64 (_mm512_ternarylogic_epi64 (A[1], A[6], A[11], 0x96), A[16], A[21], 0x96);
+  const __m512i C2 = _mm512_ternarylogic_epi64 (_mm512_ternarylogic_epi64 (A[2], A[7], A[12], 0x96), A[17], A[22], 0x96);
+  const __m512i C3 = _mm512_ternarylogic_epi64 (_mm512_ternarylogic_epi64 (A[3], A[8], A[13], 0x96), A[18], A[23], 0x96);
+  const __m512i C4 = _mm512_ternarylogic_epi64 (_mm512_ternarylogic_epi64 (A[4], A[9], A[14], 0x96), A[19], A[24], 0x96);
+  const __m512i D0 = _mm512_xor_si512 (C4, _mm512_rol_epi64 (C1, 1));
+  const __m512i D1 = _mm512_xor_si512 (C0, _mm512_rol_epi64 (C2, 1));
+  const __m512i D2 = _mm512_xor_si512 (C1, _mm512_rol_epi64 (C3, 1));
+  const __m512i D3 = _mm512_xor_si512 (C2, _mm512_rol_epi64 (C4, 1));
+  const __m512i D4 = _mm512_xor_si512 (C3, _mm512_rol_epi64 (C0, 1));
+  // rho, pi and chi per output plane
+  __m512i B0, B1, B2, B3, B4;
+  B0 = _mm512_xor_si512 (A[0], D0);
+  B1 = _mm512_rol_epi64 (_mm512_xor_si512 (A[6], D1), 44);
+  B2 = _mm512_rol_epi64 (_mm512_xor_si512 (A[12], D2), 43);
+  B3 = _mm512_rol_epi64 (_mm512_xor_si512 (A[18], D3), 21);
+  B4 = _mm512_rol_epi64 (_mm512_xor_si512 (A[24], D4), 14);
+  keccak1600_chi_x8 (&E[0], B0, B1, B2, B3, B4);
+  E[0] = _mm512_xor_si512 (E[0], round_constant);
+  B0 = _mm512_rol_epi64 (_mm512_xor_si512 (A[3], D3), 28);
+  B1 = _mm512_rol_epi64 (_mm512_xor_si512 (A[9], D4), 20);
+  B2 = _mm512_rol_epi64 (_mm512_xor_si512 (A[10], D0), 3);
+  B3 = _mm512_rol_epi64 (_mm512_xor_si512 (A[16], D1), 45);
+  B4 = _mm512_rol_epi64 (_mm512_xor_si512 (A[22], D2), 61);
+  keccak1600_chi_x8 (&E[5], B0, B1, B2, B3, B4);
+  B0 = _mm512_rol_epi64 (_mm512_xor_si512 (A[1], D1), 1);
+  B1 = _mm512_rol_epi64 (_mm512_xor_si512 (A[7], D2), 6);
+  B2 = _mm512_rol_epi64 (_mm512_xor_si512 (A[13], D3), 25);
+  B3 = _mm512_rol_epi64 (_mm512_xor_si512 (A[19], D4), 8);
+  B4 = _mm512_rol_epi64 (_mm512_xor_si512 (A[20], D0), 18);
+  keccak1600_chi_x8 (&E[10], B0, B1, B2, B3, B4);
+  B0 = _mm512_rol_epi64 (_mm512_xor_si512 (A[4], D4), 27);
+  B1 = _mm512_rol_epi64 (_mm512_xor_si512 (A[5], D0), 36);
+  B2 = _mm512_rol_epi64 (_mm512_xor_si512 (A[11], D1), 10);
+  B3 = _mm512_rol_epi64 (_mm512_xor_si512 (A[17], D2), 15);
+  B4 = _mm512_rol_epi64 (_mm512_xor_si512 (A[23], D3), 56);
+  keccak1600_chi_x8 (&E[15], B0, B1, B2, B3, B4);
+  B0 = _mm512_rol_epi64 (_mm512_xor_si512 (A[2], D2), 62);
+  B1 = _mm512_rol_epi64 (_mm512_xor_si512 (A[8], D3), 55);
+  B2 = _mm512_rol_epi64 (_mm512_xor_si512 (A[14], D4), 39);
+  B3 = _mm512_rol_epi64 (_mm512_xor_si512 (A[15], D0), 41);
+  B4 = _mm512_rol_epi64 (_mm512_xor_si512 (A[21], D1), 2);
+  keccak1600_chi_x8 (&E[20], B0, B1, B2, B3, B4);
+}
+
+/** Keccak-f[1600] permutation of 8 independent states, interleaved as `A[8 * i + l]` = lane `i` of state `l`.
+ * Runs the states in the 8 lanes of AVX-512 registers, needs keccak1600_avx512_supported().
+ */
+KECCAK_AVX512_TARGET static void
+keccak1600_permute_x8_avx512 (std::array<uint64_t,200> &A, const uint32_t n_rounds)
+{
+  assert (n_rounds < 255);
+  __m512i S[25], E[25];
+  for (size_t i = 0; i < 25; i++)
+    S[i] = _mm512_loadu_si512 (&A[8 * i]);
+  uint32_t r = 0;
+  for (; r + 2 <= n_rounds; r += 2) {
+    keccak1600_round_x8 (S, E, _mm512_set1_epi64 (KECCAK_ROUND_CONSTANTS[r]));
+    keccak1600_round_x8 (E, S, _mm512_set1_epi64 (KECCAK_ROUND_CONSTANTS[r + 1]));
+  }
+  if (r < n_rounds) {
+    keccak1600_round_x8 (S, E, _mm512_set1_epi64 (KECCAK_ROUND_CONSTANTS[r]));
+    for (size_t i = 0; i < 25; i++)
+      S[i] = E[i];
+  }
+  for (size_t i = 0; i < 25; i++)
+    _mm512_storeu_si512 (&A[8 * i], S[i]);
+}
+
+/// Lane indices for pi in keccak1600_permute_avx512(), output plane Y, lane X takes lane (X + 3 * Y) % 5 of input plane X.
+struct KeccakPiIndex {
+  uint64_t v01[5][8];   // lanes 0, 1 from planes 0, 1 (permutex2var)
+  uint64_t v23[5][8];   // lanes 2, 3 from planes 2, 3 (permutex2var)
+  uint64_t v4[5][8];    // lane 4 from plane 4 (permutexvar)
+};
+static constexpr KeccakPiIndex
+keccak_pi_index ()
+{
+  KeccakPiIndex t {};
+  for (unsigned Y = 0; Y < 5; Y++)
+    for (unsigned X = 0; X < 5; X++) {
+      const uint64_t x = (X + 3 * Y) % 5;
+      if (X < 2)
+        t.v01[Y][X] = x + 8 * X;
+      else if (X < 4)
+        t.v23[Y][X] = x + 8 * (X - 2);
+      else
+        t.v4[Y][X] = x;
+    }
+  return t;
+}
+
+/** Single state Keccak-f[1600] permutation with one plane per AVX-512 register (lanes 5..7 stay zero).
+ * Theta and chi rotate lanes within a plane with vpermq, rho uses vprolvq and pi regathers the planes
+ * with three two-source permutes per plane, chi is a single vpternlogq per plane.
+ */
+KECCAK_AVX512_TARGET static void
+keccak1600_permute_avx512 (std::array<uint64_t,25> &state, const uint32_t n_rounds)
+{
+  assert (n_rounds < 255);
+  static constexpr KeccakPiIndex PI = keccak_pi_index();
+  const __mmask8 M5 = 0x1f;
+  const __m512i xm1 = _mm512_setr_epi64 (4, 0, 1, 2, 3, 5, 6, 7);
+  const __m512i xp1 = _mm512_setr_epi64 (1, 2, 3, 4, 0, 5, 6, 7);
+  const __m512i xp2 = _mm512_setr_epi64 (2, 3, 4, 0, 1, 5, 6, 7);
+  const __m512i rho[5] = {
+    _mm512_setr_epi64 ( 0,  1, 62, 28, 27, 0, 0, 0), _mm512_setr_epi64 (36, 44,  6, 55, 20, 0, 0, 0),
+    _mm512_setr_epi64 ( 3, 10, 43, 25, 39, 0, 0, 0), _mm512_setr_epi64 (41, 45, 15, 21,  8, 0, 0, 0),
+    _mm512_setr_epi64 (18,  2, 61, 56, 14, 0, 0, 0),
+  };
+  __m512i pi01[5], pi23[5], pi4[5];
+  for (size_t Y = 0; Y < 5; Y++) {
+    pi01[Y] = _mm512_loadu_si512 (PI.v01[Y]);
+    pi23[Y] = _mm512_loadu_si512 (PI.v23[Y]);
+    pi4[Y] = _mm512_loadu_si512 (PI.v4[Y]);
+  }
+  __m512i P[5];
+  for (size_t y = 0; y < 5; y++)
+    P[y] = _mm512_maskz_loadu_epi64 (M5, &state[5 * y]);
+  for (uint32_t r = 0; r < n_rounds; r++) {
+    // theta
+    const __m512i C = _mm512_ternarylogic_epi64 (_mm512_ternarylogic_epi64 (P[0], P[1], P[2], 0x96), P[3], P[4], 0x96);
+    const __m512i D = _mm512_xor_si512 (_mm512_permutexvar_epi64 (xm1, C), _mm512_rol_epi64 (_mm512_permutexvar_epi64 (xp1, C), 1));
+    // rho
+    __m512i R[5];
+    for (size_t y = 0; y < 5; y++)
+      R[y] = _mm512_rolv_epi64 (_mm512_xor_si512 (P[y], D), rho[y]);
+    // pi
+    for (size_t Y = 0; Y < 5; Y++) {
+      const __m512i t01 = _mm512_permutex2var_epi64 (R[0], pi01[Y], R[1]);
+      const __m512i t23 = _mm512_permutex2var_epi64 (R[2], pi23[Y], R[3]);
+      const __m512i t = _mm512_mask_blend_epi64 (0x0c, t01, t23);
+      P[Y] = _mm512_mask_permutexvar_epi64 (t, 0x10, pi4[Y], R[4]);
+    }
+    // chi, the masked permutes keep lanes 5..7 zero
+    for (size_t y = 0; y < 5; y++)
+      P[y] = _mm512_maskz_ternarylogic_epi64 (M5, P[y], _mm512_permutexvar_epi64 (xp1, P[y]), _mm512_permutexvar_epi64 (xp2, P[y]), 0xD2);
+    // iota
+    P[0] = _mm512_mask_xor_epi64 (P[0], 0x01, P[0], _mm512_set1_epi64 (KECCAK_ROUND_CONSTANTS[r]));
+  }
+  for (size_t y = 0; y < 5; y++)
+    _mm512_mask_storeu_epi64 (&state[5 * y], M5, P[y]);
+}
+
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ == 12
+#pragma GCC diagnostic pop
+#endif
+
+#undef KECCAK_AVX512_TARGET
+#undef KECCAK_AVX512_INLINE
+#else  // !__x86_64__
+#define KECCAK_HAVE_AVX512      0
+static inline bool keccak1600_avx512_supported () { return false; }
+#endif // !__x86_64__
+
+/** Keccak-f[1600] permutation of 8 interleaved states, as `A[8 * i + l]` = lane `i` of state `l`.
+ * Uses AVX-512 if the CPU supports it, otherwise two keccak1600_permute_x4() calls.
+ */
+extern inline void
+keccak1600_permute_x8 (std::array<uint64_t,200> &A, const uint32_t n_rounds)
+{
+#if KECCAK_HAVE_AVX512
+  static const bool avx512 = keccak1600_avx512_supported();
+  if (avx512)
+    return keccak1600_permute_x8_avx512 (A, n_rounds);
+#endif
+  for (size_t h = 0; h < 2; h++) {
+    std::array<uint64_t,100> x4;
+    for (size_t i = 0; i < 25; i++)
+      for (size_t l = 0; l < 4; l++)
+        x4[4 * i + l] = A[8 * i + 4 * h + l];
+    keccak1600_permute_x4 (x4, n_rounds);
+    for (size_t i = 0; i < 25; i++)
+      for (size_t l = 0; l < 4; l++)
+        A[8 * i + 4 * h + l] = x4[4 * i + l];
+  }
+}
+
+/** KeccakRngX4 - Four KeccakRng substreams generated with keccak1600_permute_x4().
+ * The output interleaves the 64 bit numbers of the four generators it was created from,
+ * i.e. word `4 * k + l` is the `k`-th number of generator `l`.
+ */
+class KeccakRngX4 {
+  const uint16_t           bit_rate_, n_rounds_;
+  uint32_t                 opos_ = 0;
+  alignas (32) std::array<uint64_t,100> A;
+  void                     permute1600 () { keccak1600_permute_x4 (A, n_rounds_); opos_ = 0; }
+public:
+  /// Amount of 64 bit random numbers per generated block and substream.
+  inline size_t n_nums () const { return bit_rate_ / 64; }
+  /// Continue the streams of four generators with equal parameters and output positions.
+  explicit
+  KeccakRngX4 (const KeccakRng (&rngs)[4]) :
+    bit_rate_ (rngs[0].bit_rate_), n_rounds_ (rngs[0].n_rounds_), opos_ (rngs[0].opos_)
+  {
+    for (size_t l = 0; l < 4; l++) {
+      assert (rngs[l].bit_rate_ == bit_rate_ && rngs[l].n_rounds_ == n_rounds_ && rngs[l].opos_ == opos_);
+      for (size_t i = 0; i < 25; i++)
+        A[4 * i + l] = rngs[l].state_.A[i];
+    }
+  }
+  ~KeccakRngX4() { A = std::array<uint64_t,100>{}; }
+  /// Fill `words` with `4 * n` random numbers, `n` from each substream in interleaved order.
+  void
+  generate (uint64_t *words, size_t n)
+  {
+    while (n) {
+      if (opos_ >= n_nums())
+        permute1600();
+      const size_t k = std::min (n, n_nums() - opos_);
+      memcpy (words, &A[4 * opos_], 4 * k * sizeof (uint64_t));
+      words += 4 * k;
+      opos_ += k;
+      n -= k;
+    }
+  }
+};
+
 } // scl::Keccak
 
 #endif // __KECCAK_HH__
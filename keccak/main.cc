@@ -4,9 +4,11 @@
 #include <cstdint>
 #include <cassert>
 #include <cstring>
+#include <algorithm>
 
 #include "keccak.hh"
 #include "keccak.cc"
+#include "../generate-threaded.hh"
 
 /// Return the current time as uint64 in nanoseconds.
 extern inline uint64_t timestamp_nsecs() { return std::chrono::steady_clock::now().time_since_epoch().count(); }
@@ -41,8 +43,8 @@ keccak_tests ()
   printf ("  OK    msg-16\n");
 
 #include "testvectors.c"       // const struct { const char *hexin, *hexout; } keccak_tests[] = {...};
-  unsigned t;
-  for (t = 0; t < sizeof (keccak_tests) / sizeof (keccak_tests[0]); t++) {
+  const unsigned n_tests = sizeof (keccak_tests) / sizeof (keccak_tests[0]);
+  for (unsigned t = 0; t < n_tests; t++) {
     const auto vin = parse_hex (keccak_tests[t].hexin), vout = parse_hex (keccak_tests[t].hexout);
     kr.reset();
     if (0 == vin.size() % 8)
@@ -54,7 +56,71 @@ keccak_tests ()
     assert (vout == r);
     // printf ("  OK    msg-%d, ilen=%zd, olen=%zd\n", t, vin.size(), vout.size());
   }
-  printf ("  OK    %u test vectors\n", t);
+  printf ("  OK    %u test vectors\n", n_tests);
+
+  // Hash N test vectors at once, one per interleaved state, with the sponge of KeccakRng (rate 1024 bits).
+  auto lanes_kat = [&] (auto N, auto &lanes, const auto &permute) {
+    constexpr size_t RATE = 128;
+    auto blocks = [&] (unsigned t) { return strlen (keccak_tests[t].hexin) / 2 / RATE + 1; };
+    std::vector<unsigned> order (n_tests);
+    for (unsigned t = 0; t < n_tests; t++)
+      order[t] = t;
+    std::stable_sort (order.begin(), order.end(), [&] (unsigned a, unsigned b) { return blocks (a) < blocks (b); });
+    for (size_t g = 0; g < n_tests; ) {
+      // group up to N vectors with the same number of absorbed blocks, repeat the first to fill up
+      unsigned group[N];
+      size_t n = 0;
+      for (; n < N && g + n < n_tests && blocks (order[g + n]) == blocks (order[g]); n++)
+        group[n] = order[g + n];
+      for (size_t l = n; l < N; l++)
+        group[l] = group[0];
+      g += n;
+      const size_t nblocks = blocks (group[0]);
+      std::vector<uint8_t> padded[N], vout[N];
+      for (size_t l = 0; l < N; l++) {
+        padded[l] = parse_hex (keccak_tests[group[l]].hexin);
+        const size_t len = padded[l].size();
+        padded[l].resize (nblocks * RATE, 0);
+        padded[l][len] ^= 0x01;
+        padded[l][nblocks * RATE - 1] ^= 0x80;
+        vout[l] = parse_hex (keccak_tests[group[l]].hexout);
+      }
+      lanes.fill (0);
+      for (size_t b = 0; b < nblocks; b++) {
+        for (size_t l = 0; l < N; l++)
+          for (size_t i = 0; i < RATE / 8; i++) {
+            uint64_t w;
+            memcpy (&w, &padded[l][b * RATE + 8 * i], 8);
+            lanes[N * i + l] ^= w;
+          }
+        permute (lanes, 24);
+      }
+      for (size_t pos = 0; pos < vout[0].size(); pos += RATE) {
+        if (pos)
+          permute (lanes, 24);
+        for (size_t l = 0; l < N; l++)
+          for (size_t j = pos; j < std::min (pos + RATE, vout[l].size()); j++)
+            assert (vout[l][j] == uint8_t (lanes[N * (j % RATE / 8) + l] >> (j % 8 * 8)));
+      }
+    }
+  };
+  // every single state implementation, as a sponge over one lane
+  std::array<uint64_t,25> lanes1;
+  lanes_kat (std::integral_constant<size_t, 1>(), lanes1, keccak1600_permute_ref);
+  printf ("  OK    %u test vectors (reference)\n", n_tests);
+  lanes_kat (std::integral_constant<size_t, 1>(), lanes1, keccak1600_permute_unrolled<true>);
+  lanes_kat (std::integral_constant<size_t, 1>(), lanes1, keccak1600_permute_unrolled<false>);
+  printf ("  OK    %u test vectors (lane complementing, andn)\n", n_tests);
+  if (keccak1600_avx512_supported()) {
+    lanes_kat (std::integral_constant<size_t, 1>(), lanes1, keccak1600_permute_avx512);
+    printf ("  OK    %u test vectors (AVX-512)\n", n_tests);
+  }
+  std::array<uint64_t,100> lanes4;
+  lanes_kat (std::integral_constant<size_t, 4>(), lanes4, keccak1600_permute_x4);
+  printf ("  OK    %u test vectors (x4)\n", n_tests);
+  std::array<uint64_t,200> lanes8;
+  lanes_kat (std::integral_constant<size_t, 8>(), lanes8, keccak1600_permute_x8);
+  printf ("  OK    %u test vectors (x8%s)\n", n_tests, keccak1600_avx512_supported() ? " AVX-512" : "");
 
   KeccakRng k1, k2;
   assert (k1 == k2);
@@ -69,9 +135,122 @@ keccak_tests ()
   printf ("  OK    KeccakRng auto_seed()\n");
 }
 
+static void
+keccak_permute_tests ()
+{
+  using namespace scl::Keccak;
+  std::array<uint64_t,25> state;
+  uint64_t x = 0x9E3779B97F4A7C15;
+  for (uint32_t n_rounds : { 1, 2, 3, 12, 23, 24, 37, 254 }) {
+    for (auto &v : state) {
+      x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+      v = x;
+    }
+    std::array<uint64_t,25> ref = state, complemented = state, andn = state;
+    keccak1600_permute_ref (ref, n_rounds);
+    keccak1600_permute_unrolled<true> (complemented, n_rounds);
+    keccak1600_permute_unrolled<false> (andn, n_rounds);
+    assert (ref == complemented && ref == andn);
+    if (keccak1600_avx512_supported()) {
+      std::array<uint64_t,25> avx512 = state;
+      keccak1600_permute_avx512 (avx512, n_rounds);
+      assert (ref == avx512);
+    }
+  }
+  printf ("  OK    unrolled keccak1600 permutations match the reference\n");
+  std::array<std::array<uint64_t,25>,8> states;
+  std::array<uint64_t,200> lanes;
+  for (uint32_t n_rounds : { 1, 5, 24 }) {
+    for (size_t l = 0; l < 8; l++)
+      for (size_t i = 0; i < 25; i++) {
+        x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+        states[l][i] = lanes[8 * i + l] = x;
+      }
+    keccak1600_permute_x8 (lanes, n_rounds);
+    for (size_t l = 0; l < 8; l++) {
+      keccak1600_permute_ref (states[l], n_rounds);
+      for (size_t i = 0; i < 25; i++)
+        assert (lanes[8 * i + l] == states[l][i]);
+    }
+  }
+  printf ("  OK    keccak1600_permute_x8 matches 8 single permutations\n");
+}
+
+/// Print cycles per 24 round Keccak-f[1600] permutation for each implementation.
+static void
+keccak_permute_bench ()
+{
+  using namespace scl::Keccak;
+  constexpr size_t N = 200000;
+  auto bench = [] (const char *what, void (*permute) (std::array<uint64_t,25>&, uint32_t)) {
+    std::array<uint64_t,25> state{};
+    const uint64_t t1 = timestamp_nsecs(), c1 = __rdtsc();
+    for (size_t i = 0; i < N; i++)
+      permute (state, 24);
+    const uint64_t c2 = __rdtsc(), t2 = timestamp_nsecs();
+    dprintf (2, " %-24s %6.1f cycles/permutation, %6.1f ns/permutation (%x)\n", what,
+             (c2 - c1) / double (N), (t2 - t1) / double (N), unsigned (state[0] & 1));
+  };
+  bench ("keccak1600_permute_ref", keccak1600_permute_ref);
+  bench ("lane complementing", keccak1600_permute_unrolled<true>);
+  bench ("andn", keccak1600_permute_unrolled<false>);
+  if (keccak1600_avx512_supported())
+    bench ("avx512 row-vectorized", keccak1600_permute_avx512);
+  std::array<uint64_t,100> lanes{};
+  const uint64_t t1 = timestamp_nsecs(), c1 = __rdtsc();
+  for (size_t i = 0; i < N; i++)
+    keccak1600_permute_x4 (lanes, 24);
+  const uint64_t c2 = __rdtsc(), t2 = timestamp_nsecs();
+  dprintf (2, " %-24s %6.1f cycles/permutation, %6.1f ns/permutation (%x)\n", "keccak1600_permute_x4",
+           (c2 - c1) / (4.0 * N), (t2 - t1) / (4.0 * N), unsigned (lanes[0] & 1));
+  std::array<uint64_t,200> lanes8{};
+  const uint64_t t3 = timestamp_nsecs(), c3 = __rdtsc();
+  for (size_t i = 0; i < N; i++)
+    keccak1600_permute_x8 (lanes8, 24);
+  const uint64_t c4 = __rdtsc(), t4 = timestamp_nsecs();
+  dprintf (2, " %-24s %6.1f cycles/permutation, %6.1f ns/permutation (%x)\n", "keccak1600_permute_x8",
+           (c4 - c3) / (8.0 * N), (t4 - t3) / (8.0 * N), unsigned (lanes8[0] & 1));
+}
+
+/// Derive the generator for the substream of worker `w` by absorbing `w`, worker 0 continues `kr`.
+static scl::Keccak::KeccakRng
+substream_rng (const scl::Keccak::KeccakRng &kr, uint64_t w)
+{
+  scl::Keccak::KeccakRng sub = kr;
+  if (w)
+    sub.update64 (&w, 1);
+  return sub;
+}
+
+/** Generate `nbytes` from four interleaved substreams with KeccakRngX4, see substream_rng().
+ * Word `4 * k + l` of the output is the `k`-th number of substream `l`.
+ */
 static uint64_t
-generate_bytes (scl::Keccak::KeccakRng &kr, const uint64_t nbytes, FILE *fout)
+generate_bytes_x4 (scl::Keccak::KeccakRng &kr, const uint64_t nbytes, FILE *fout)
 {
+  const scl::Keccak::KeccakRng subs[4] = { substream_rng (kr, 0), substream_rng (kr, 1), substream_rng (kr, 2), substream_rng (kr, 3) };
+  scl::Keccak::KeccakRngX4 x4 (subs);
+  const size_t N = std::min (nbytes, 4 * 1024 * 1024ul) / 32;
+  std::vector<uint64_t> buffer (4 * std::max (N, 1ul));
+  uint64_t nb;
+  for (nb = 0; nb < nbytes; nb += buffer.size() * 8) {
+    x4.generate (buffer.data(), buffer.size() / 4);
+    if (fout)
+      fwrite (buffer.data(), buffer.size() * 8, 1, fout);
+  }
+  return nb;
+}
+
+static uint64_t
+generate_bytes (scl::Keccak::KeccakRng &kr, const uint64_t nbytes, unsigned threads, FILE *fout, bool x4 = false)
+{
+  assert (!x4 || !threads);
+  if (x4)
+    return generate_bytes_x4 (kr, nbytes, fout);
+  if (threads)
+    return generate_threaded (threads, nbytes, 1024 * 1024, fout, [&kr] (unsigned w) {
+      return [g = substream_rng (kr, w)] (uint64_t, uint8_t *dest) mutable { g.generate (dest, dest + 1024 * 1024); };
+    });
   const unsigned N = std::min (nbytes, 4 * 1024 * 1024ul);
   std::vector<uint8_t> buffer (N, 0);
   uint64_t nb;
@@ -83,18 +262,84 @@ generate_bytes (scl::Keccak::KeccakRng &kr, const uint64_t nbytes, FILE *fout)
   return nb;
 }
 
+static void
+keccak_x4_tests ()
+{
+  using namespace scl::Keccak;
+  std::array<uint64_t,100> lanes;
+  std::array<uint64_t,25> states[4];
+  uint64_t x = 0x9E3779B97F4A7C15;
+  for (uint32_t n_rounds : { 1, 24, 37 }) {
+    for (size_t i = 0; i < 100; i++) {
+      x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+      lanes[i] = states[i % 4][i / 4] = x;
+    }
+    keccak1600_permute_x4 (lanes, n_rounds);
+    for (size_t l = 0; l < 4; l++) {
+      keccak1600_permute_ref (states[l], n_rounds);
+      for (size_t i = 0; i < 25; i++)
+        assert (lanes[4 * i + l] == states[l][i]);
+    }
+  }
+  printf ("  OK    keccak1600_permute_x4 matches 4 single permutations\n");
+  KeccakRng kr;
+  kr.seed (0x5eed);
+  KeccakRng subs[4] = { substream_rng (kr, 0), substream_rng (kr, 1), substream_rng (kr, 2), substream_rng (kr, 3) };
+  KeccakRngX4 x4 (subs);
+  std::vector<uint64_t> words (4 * 1000);
+  x4.generate (words.data(), 7);
+  x4.generate (words.data() + 4 * 7, 1000 - 7);
+  for (size_t k = 0; k < 1000; k++)
+    for (size_t l = 0; l < 4; l++)
+      assert (words[4 * k + l] == subs[l].next());
+  printf ("  OK    KeccakRngX4 interleaves 4 KeccakRng substreams\n");
+}
+
+static void
+keccak_threaded_tests ()
+{
+  using namespace scl::Keccak;
+  KeccakRng k1;
+  k1.seed (0x1234);
+  constexpr size_t T = 3, CHUNK = 1024 * 1024, NCHUNKS = 7;
+  char *mem = nullptr;
+  size_t memsize = 0;
+  FILE *fmem = open_memstream (&mem, &memsize);
+  generate_bytes (k1, NCHUNKS * CHUNK, T, fmem);
+  fclose (fmem);
+  assert (memsize == NCHUNKS * CHUNK);
+  std::vector<uint8_t> chunk (CHUNK);
+  KeccakRng subs[T] = { substream_rng (k1, 0), substream_rng (k1, 1), substream_rng (k1, 2) };
+  assert (subs[0] == k1 && subs[1] != k1 && subs[1] != subs[2]);
+  for (size_t k = 0; k < NCHUNKS; k++) {
+    subs[k % T].generate (chunk.begin(), chunk.end());
+    assert (0 == memcmp (mem + k * CHUNK, chunk.data(), CHUNK));
+  }
+  free (mem);
+  printf ("  OK    KeccakRng substreams reassembled from %zu threads\n", T);
+}
+
 int
 main (int argc, const char *argv[])
 {
   uint64_t custom_seed = 0;
   bool auto_seed = true;
+  unsigned threads = 0; // generate in the calling thread
+  bool x4 = false;
 
   double streamlen = 0;
   for (int i = 1; i < argc; i++)
     if (0 == strcasecmp (argv[i], "--check")) {
       keccak_tests();
+      keccak_permute_tests();
+      keccak_x4_tests();
+      keccak_threaded_tests();
       return 0;
-    } else if (0 == strcasecmp (argv[i], "--seed") && i+1 < argc) {
+    } else if (0 == strcasecmp (argv[i], "--x4"))
+      x4 = true;
+    else if (0 == strcasecmp (argv[i], "--threads") && i+1 < argc)
+      threads = std::max (1ul, strtoul (argv[++i], nullptr, 0));
+    else if (0 == strcasecmp (argv[i], "--seed") && i+1 < argc) {
       custom_seed = strtoull (argv[++i], nullptr, 0);
       auto_seed = false;
     } else if (0 == strcmp (argv[i], "--bench")) {
@@ -111,6 +356,12 @@ main (int argc, const char *argv[])
           }
     }
 
+  if (x4 && threads) {
+    // --x4 interleaves substreams 0..3 itself, see generate_bytes_x4()
+    dprintf (2, "%s: --x4 cannot be combined with --threads\n", argv[0]);
+    return 1;
+  }
+
   scl::Keccak::KeccakRng rg;
   if (auto_seed)
     rg.auto_seed();
@@ -121,12 +372,13 @@ main (int argc, const char *argv[])
     streamlen = std::min (streamlen, 0x1p+63); // 2^63 = 9223372036854775808
     dprintf (2, "BENCH: %zu Bytes\n", size_t (streamlen));
     auto t1 = timestamp_nsecs();
-    const size_t total = generate_bytes (rg, uint64_t (streamlen), nullptr);
+    const size_t total = generate_bytes (rg, uint64_t (streamlen), threads, nullptr, x4);
     auto t2 = timestamp_nsecs();
     dprintf (2, " %.3f msecs (%zu Bytes), %f GB/sec\n", (t2 - t1) / 1000000.0, total, total * (1000000000.0 / (1024*1024*1024)) / (t2 - t1));
+    keccak_permute_bench();
   }
   else
-    generate_bytes (rg, ~uint64_t (0), stdout);
+    generate_bytes (rg, ~uint64_t (0), threads, stdout, x4);
 
   return 0;
 }
@@ -1,6 +1,7 @@
 // Dedicated to the Public Domain under the Unlicense: https://unlicense.org/UNLICENSE
 
 #include <vector>
+#include <algorithm>
 #include <cstdio>
 #include <cassert>
 #include <cstring>
@@ -9,22 +10,79 @@
 #include <sys/random.h>
 
 #include "mwc256.hh"
+#include "../generate-threaded.hh"
 
 /// Return the current time as uint64 in nanoseconds.
 extern inline uint64_t timestamp_nsecs() { return std::chrono::steady_clock::now().time_since_epoch().count(); }
 
 static size_t
-generate_bytes (const std::array<uint64_t, 4> &seeds, const uint64_t nbytes, FILE *fout)
+generate_bytes (const std::array<uint64_t, 4> &seeds, const uint64_t nbytes, unsigned kind, unsigned threads, FILE *fout)
 {
   using namespace scl;
   const unsigned N = 1024;
   alignas (64) uint64_t buffer[N];
   alignas (64) Mwc256 prng { seeds };
   uint64_t nb;
-  for (nb = 0; nb < nbytes; nb += sizeof (buffer)) {
+  if (threads) {
+    // Worker substreams are spaced by jump_192(), SIMD lanes within a worker are spaced by jump_128()
+    constexpr size_t CHUNK = 1024 * 1024;
+    const auto substream = [&prng] (unsigned w) {
+      Mwc256 p = prng;
+      for (unsigned i = 0; i < w; i++)
+        p.jump_192();
+      return p;
+    };
+#if defined(__AVX512F__)
+    if (kind >= 8)
+      return generate_threaded (threads, nbytes, CHUNK, fout, [&] (unsigned w) {
+        return [g = Mwc256x8 (substream (w))] (uint64_t, uint8_t *dest) mutable { g.fill ((uint64_t*) dest, CHUNK / 8); };
+      });
+#endif
+#if defined(__AVX2__)
+    if (kind >= 4)
+      return generate_threaded (threads, nbytes, CHUNK, fout, [&] (unsigned w) {
+        return [g = Mwc256x4 (substream (w))] (uint64_t, uint8_t *dest) mutable { g.fill ((uint64_t*) dest, CHUNK / 8); };
+      });
+#endif
+    return generate_threaded (threads, nbytes, CHUNK, fout, [&] (unsigned w) {
+      return [g = substream (w)] (uint64_t, uint8_t *dest) mutable { g.fill ((uint64_t*) dest, CHUNK / 8); };
+    });
+  }
+#if defined(__AVX512F__)
+  if (kind >= 8) { // Avx512
+    Mwc256x8 prngx8 { prng };
+    for (nb = 0; nb < nbytes; nb += sizeof (buffer)) {
+      prngx8.fill (buffer, N);
+      if (fout)
+        fwrite (buffer, sizeof (buffer), 1, fout);
+    }
+    return nb;
+  }
+#endif
+#if defined(__AVX2__)
+  if (kind >= 4) { // Avx2
+    Mwc256x4 prngx4 { prng };
+    for (nb = 0; nb < nbytes; nb += sizeof (buffer)) {
+      prngx4.fill (buffer, N);
+      if (fout)
+        fwrite (buffer, sizeof (buffer), 1, fout);
+    }
+    return nb;
+  }
+#endif
+  if (kind >= 1) { // ALU, bulk fill()
+    for (nb = 0; nb < nbytes; nb += sizeof (buffer)) {
+      prng.fill (buffer, N);
+      if (fout)
+        fwrite (buffer, sizeof (buffer), 1, fout);
+    }
+    return nb;
+  }
+  for (nb = 0; nb < nbytes; nb += sizeof (buffer)) { // kind == 0, per call next()
     for (uint i = 0; i < sizeof (buffer) / sizeof (buffer[0]); i++)
       buffer[i] = prng.next();
-    fwrite (buffer, sizeof (buffer), 1, fout);
+    if (fout)
+      fwrite (buffer, sizeof (buffer), 1, fout);
   }
   return nb;
 }
@@ -34,6 +92,11 @@ mwc256_tests()
 {
   using namespace scl;
   Mwc256 a, b = a;
+  a.next();
+  a.next();
+  assert (a.next() == 0xd1e311874c36b562);      // stream of the default seed
+  assert (a.next() == 0xbe7eca6bfdbc73be);
+  a = b;
   assert (a.next() == b.next());
   assert (a.next() == b.next());
   assert (a.next() == b.next());
@@ -61,6 +124,180 @@ mwc256_tests()
   assert (a.next() == c.next()); d.next();
   assert (a.next() == d.next()); c.next();
   printf ("  OK    Mwc256State next and jumps\n");
+  Mwc256 e, f = e, g = e;
+  for (size_t i = 0; i < 12345; i++)
+    e.next();
+  f.discard (12345);
+  assert (e.next() == f.next());
+  assert (e.next() == f.next());
+  f.discard (0);
+  assert (e.next() == f.next());
+  e.discard (0x123456789abcdefULL);
+  f.discard (0x023456789abcdefULL);
+  f.discard (0x100000000000000ULL);
+  assert (e.next() == f.next());
+  g.jump_128();
+  e = g;
+  f = g;
+  e.jump_192();
+  f.jump (192);
+  assert (e.next() == f.next());
+  f = g;
+  g.discard (__uint128_t (1) << 127);
+  g.discard (__uint128_t (1) << 127);
+  f.jump_128();
+  assert (g.next() == f.next());
+  const uint64_t t1 = timestamp_nsecs();
+  uint64_t sum = 0;
+  for (size_t i = 0; i < 1000; i++) {
+    g.discard (~__uint128_t (0) - i);
+    sum += g.next();
+  }
+  const uint64_t t2 = timestamp_nsecs();
+  assert (sum != 0);
+  Mwc256 h, k = h;
+  std::vector<uint64_t> words (1001);
+  h.fill (words.data(), 0);
+  h.fill (words.data(), 1);
+  h.fill (words.data() + 1, words.size() - 2);
+  for (size_t i = 0; i < words.size() - 1; i++)
+    assert (words[i] == k.next());
+  uint8_t bytes[8 * 67 + 1];
+  for (size_t offset = 0; offset < 8; offset++)
+    for (size_t n : { 0, 5, 8, 13, 8 * 67 - 8 }) {
+      Mwc256 p = h, q = h;
+      p.fill_bytes (bytes + offset, n);
+      for (size_t j = 0; j < n; j += 8) {
+        const uint64_t v = q.next();
+        assert (0 == memcmp (bytes + offset + j, &v, std::min (size_t (8), n - j)));
+      }
+      assert (p.next() == q.next());
+    }
+  printf ("  OK    Mwc256 fill() and fill_bytes()\n");
+  printf ("  OK    Mwc256 discard() and jump(), %.3f usecs per 2^128 discard\n", (t2 - t1) / 1000.0 / 1000);
+}
+
+template<class Mwc> static void
+mwc_family_tests (const char *name, void (Mwc::*jump_a) (), unsigned ea, void (Mwc::*jump_b) (), unsigned eb)
+{
+  Mwc a { { 0x1234, 0x5678, 0x9abc, 0xdef0 } }, b = a, c = a;
+  for (size_t i = 0; i < 12345; i++)
+    a.next();
+  b.discard (12345);
+  assert (a.next() == b.next());
+  b = c;
+  (b.*jump_a) ();
+  c.discard (__uint128_t (1) << (ea - 1));
+  c.discard (__uint128_t (1) << (ea - 1));
+  assert (b.next() == c.next());
+  (b.*jump_b) ();
+  c.jump (eb);
+  assert (b.next() == c.next());
+  a = b;
+  a.jump (eb - 1);
+  a.jump (eb - 1);
+  (b.*jump_b) ();
+  assert (a.next() == b.next());
+  std::vector<uint64_t> words (1001);
+  b = a;
+  a.fill (words.data(), words.size());
+  for (size_t i = 0; i < words.size(); i++)
+    assert (words[i] == b.next());
+  assert (a.next() == b.next());
+  printf ("  OK    %s next, fill, jumps and discard(), %zu bytes per instance\n", name, sizeof (Mwc));
+}
+
+/// Generate `N` values at compile time after seeding and jumping, for the constexpr tests.
+template<class Mwc, size_t N> static constexpr std::array<uint64_t,N>
+mwc_constexpr_table (uint64_t s0, unsigned e, uint64_t discard)
+{
+  Mwc g { { s0, 2, 3, 4 } };
+  g.jump (e);
+  g.discard (discard);
+  std::array<uint64_t,N> table = {};
+  for (size_t i = 0; i < N; i++)
+    table[i] = g.next();
+  return table;
+}
+
+static void
+mwc_constexpr_tests()
+{
+  using namespace scl;
+  constexpr auto table256 = mwc_constexpr_table<Mwc256,64> (1, 130, 77777);
+  constexpr auto table128 = mwc_constexpr_table<Mwc128,64> (1, 70, 77777);
+  static_assert (Mwc256().next() == 0x22a15b8ebe150332);
+  constexpr uint64_t jumped = [] () { Mwc256 g; g.jump_128(); g.jump_192(); return g.next(); } ();
+  volatile uint64_t s0 = 1; // force runtime evaluation
+  Mwc256 g { { s0, 2, 3, 4 } };
+  g.jump (130);
+  g.discard (77777);
+  for (size_t i = 0; i < table256.size(); i++)
+    assert (table256[i] == g.next());
+  Mwc128 h { { s0, 2, 3, 4 } };
+  h.jump (70);
+  h.discard (77777);
+  for (size_t i = 0; i < table128.size(); i++)
+    assert (table128[i] == h.next());
+  Mwc256 k;
+  k.jump_128();
+  k.jump_192();
+  assert (jumped == k.next());
+  printf ("  OK    Mwc256 and Mwc128 constexpr sequences match runtime\n");
+}
+
+static void
+mwc256_threaded_tests()
+{
+  using namespace scl;
+  const Mwc256 prng { { 0x1234, 0x5678, 0x9abc, 0xdef0 } };
+  const auto substream = [&prng] (unsigned w) {
+    Mwc256 p = prng;
+    for (unsigned i = 0; i < w; i++)
+      p.jump_192();
+    return p;
+  };
+  constexpr size_t T = 3, CHUNK = 64, NCHUNKS = 100;
+  char *mem = nullptr;
+  size_t memsize = 0;
+  FILE *fmem = open_memstream (&mem, &memsize);
+  const size_t total = generate_threaded (T, NCHUNKS * CHUNK - 7, CHUNK, fmem, [&] (unsigned w) {
+    return [g = substream (w)] (uint64_t, uint8_t *dest) mutable { g.fill ((uint64_t*) dest, CHUNK / 8); };
+  });
+  fclose (fmem);
+  assert (total == NCHUNKS * CHUNK && memsize == total);
+  Mwc256 lanes[T] = { substream (0), substream (1), substream (2) };
+  for (size_t k = 0; k < NCHUNKS; k++)
+    for (size_t i = 0; i < CHUNK / 8; i++) {
+      const uint64_t v = lanes[k % T].next();
+      assert (0 == memcmp (mem + k * CHUNK + i * 8, &v, 8));
+    }
+  free (mem);
+  printf ("  OK    Mwc256 substreams reassembled from %zu threads\n", T);
+}
+
+template<class MwcSimd> static void
+mwc256_simd_tests (const char *name)
+{
+  using namespace scl;
+  constexpr size_t L = MwcSimd::LANES, N = 1027;
+  Mwc256 lanes[L];
+  Mwc256 p { { 0x1234, 0x5678, 0x9abc, 0xdef0 } };
+  MwcSimd simd { p };
+  for (size_t l = 0; l < L; l++) {
+    lanes[l] = p;
+    p.jump_128();
+  }
+  std::vector<uint64_t> buffer (N * L + 3);
+  simd.fill (buffer.data(), 5);         // discards the rest of a partial row
+  for (size_t i = 0; i < (5 + L - 1) / L * L; i++) {
+    const uint64_t v = lanes[i % L].next();
+    assert (i >= 5 || buffer[i] == v);
+  }
+  simd.fill (buffer.data(), buffer.size());
+  for (size_t i = 0; i < buffer.size(); i++)
+    assert (buffer[i] == lanes[i % L].next());
+  printf ("  OK    %s matches %zu scalar Mwc256\n", name, L);
 }
 
 
@@ -72,12 +309,34 @@ main (int argc, const char *argv[])
   seeds[0] = timestamp_nsecs(); // "nonce"
 
   double streamlen = 0;
+  unsigned kind = 1; // ALU, SIMD lanes produce a different stream
+  unsigned threads = 0; // generate in the calling thread
   for (int i = 1; i < argc; i++)
     if (0 == strcasecmp (argv[i], "--check")) {
       mwc256_tests();
+      static_assert (sizeof (scl::Mwc128) == 16 && sizeof (scl::Mwc192) == 24);
+      mwc_family_tests<scl::Mwc128> ("Mwc128", &scl::Mwc128::jump_64, 64, &scl::Mwc128::jump_96, 96);
+      mwc_family_tests<scl::Mwc192> ("Mwc192", &scl::Mwc192::jump_96, 96, &scl::Mwc192::jump_144, 144);
+      mwc_family_tests<scl::Mwc256> ("Mwc256", &scl::Mwc256::jump_128, 128, &scl::Mwc256::jump_192, 192);
+      mwc_constexpr_tests();
+      mwc256_threaded_tests();
+#if defined(__AVX2__)
+      mwc256_simd_tests<scl::Mwc256x4> ("Mwc256x4");
+#endif
+#if defined(__AVX512F__)
+      mwc256_simd_tests<scl::Mwc256x8> ("Mwc256x8");
+#endif
       return 0;
-    } else if (0 == strcasecmp (argv[i], "--alu"))
-      /**/; // ALU
+    } else if (0 == strcasecmp (argv[i], "--next"))
+      kind = 0; // ALU, per call next()
+    else if (0 == strcasecmp (argv[i], "--alu"))
+      kind = 1; // ALU
+    else if (0 == strcasecmp (argv[i], "--avx"))
+      kind = 4; // AVX2
+    else if (0 == strcasecmp (argv[i], "--avx512"))
+      kind = 8; // AVX512
+    else if (0 == strcasecmp (argv[i], "--threads") && i+1 < argc)
+      threads = std::max (1ul, strtoul (argv[++i], nullptr, 0));
     else if (0 == strcasecmp (argv[i], "--seed") && i+1 < argc) {
       seeds = std::array<uint64_t, 4>{};
       seeds[0] = strtoull (argv[++i], nullptr, 0);
@@ -99,13 +358,19 @@ main (int argc, const char *argv[])
     streamlen = std::min (streamlen, 0x1p+63); // 2^63 = 9223372036854775808
     dprintf (2, "BENCH: %zu Bytes\n", size_t (streamlen));
     auto t1 = timestamp_nsecs();
-    fclose (stdout); // not needed for benchmarks
-    const size_t total = generate_bytes (seeds, uint64_t (streamlen), stdout);
+    const size_t total = generate_bytes (seeds, uint64_t (streamlen), kind, threads, nullptr);
     auto t2 = timestamp_nsecs();
     dprintf (2, " %.3f msecs (%zu Bytes), %f GB/sec\n", (t2 - t1) / 1000000.0, total, total * (1000000000.0 / (1024*1024*1024)) / (t2 - t1));
+    if (kind == 1 && !threads) { // compare fill() with a per call next() loop
+      auto t3 = timestamp_nsecs();
+      const size_t total0 = generate_bytes (seeds, uint64_t (streamlen), 0, threads, nullptr);
+      auto t4 = timestamp_nsecs();
+      dprintf (2, " %.3f msecs (%zu Bytes), %f GB/sec with next() calls, fill() speedup: %.2fx\n", (t4 - t3) / 1000000.0, total0,
+               total0 * (1000000000.0 / (1024*1024*1024)) / (t4 - t3), (t4 - t3) / double (t2 - t1));
+    }
   }
   else
-    generate_bytes (seeds, uint64_t (0x1p+63), stdout);
+    generate_bytes (seeds, uint64_t (0x1p+63), kind, threads, stdout);
 
   return 0;
 }
@@ -4,136 +4,472 @@
 #define __MWC256_HH__
 
 #include <cstdint>
+#include <cstddef>
+#include <cstring>
 #include <array>
 
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif // __AVX2__ || __AVX512F__
+
 namespace scl {
 
-/** Mwc256 - 256 Bit Multiply-With-Carry PRNG.
- *
- * This is a Marsaglia multiply-with-carry generator with period
- * approximately 2^255. It is faster than a scrambled linear
- * generator, as its only 128-bit operations are a multiplication and sum;
- * it is an excellent generator based on congruential arithmetic.
+/// Parameters of the MWC generator with `BITS` of state, specialized for 128, 192 and 256.
+template<unsigned BITS> struct MwcTraits;
+
+template<> struct MwcTraits<128> {
+  static constexpr uint64_t A = 0xffebb71d94fcdaf9;    // multiplier, m = A * 2^64 - 1
+  static constexpr size_t ALIGN = 16;
+  static constexpr std::array<uint64_t,2> MONT_R2 = { 0x97ddc71551352732, 0x26f6a5f546756c2b };
+};
+
+template<> struct MwcTraits<192> {
+  static constexpr uint64_t A = 0xffa04e67b3c95d86;    // multiplier, m = A * 2^128 - 1
+  static constexpr size_t ALIGN = 8;
+  static constexpr std::array<uint64_t,3> MONT_R2 = { 0x3efcd5a53a4e3b25, 0xf88820afb3803997, 0xca4c6e15baff6690 };
+};
+
+template<> struct MwcTraits<256> {
+  static constexpr uint64_t A = 0xff377e26f82da74a;    // multiplier, m = A * 2^192 - 1
+  static constexpr size_t ALIGN = 64;
+  static constexpr std::array<uint64_t,4> MONT_R2 = { 0x321354e8504963b2, 0xb318173273eb87fb, 0xa8046fc68eb885f1, 0x2cfd69f1824012a2 };
+};
+
+/** MwcRng - Multiply-With-Carry PRNG with `BITS` of state.
  *
+ * The state consists of `BITS / 64 - 1` lag words and one carry word.
  * Like all MWC generators, it simulates a multiplicative LCG with prime
- * modulus m = 0xff377e26f82da749ffffffffffffffffffffffffffffffffffffffffffffffff
- * and multiplier given by the inverse of 2^64 modulo m. The modulus has a
- * particular form, which creates some theoretical issues, but at this
- * size a generator of this kind passes all known statistical tests.
+ * modulus m = A * 2^(BITS - 64) - 1 and multiplier given by the inverse
+ * of 2^64 modulo m, the period is approximately 2^(BITS - 1).
+ * The multipliers are taken from Sebastiano Vigna's MWC128, MWC192 and
+ * MWC256 generators, for each of them (m - 1) / 2 is also prime.
+ * Use Mwc128, Mwc192 or Mwc256 which add jumps with fixed constants.
  */
-class Mwc256 {
-  alignas (64) std::array<uint64_t,4> state_ = { 0, 0, 0, 0 };
-  static constexpr uint64_t MWC256_A3 = 0xff377e26f82da74a;
-  void state_mul256 (const std::array<uint64_t,5> &b);
+template<unsigned BITS>
+class MwcRng {
+protected:
+  static constexpr size_t W = BITS / 64;
+  static_assert (W >= 2 && W <= 4);
+  static constexpr uint64_t A = MwcTraits<BITS>::A;
+  using MpNum = std::array<uint64_t,W>;
+  alignas (MwcTraits<BITS>::ALIGN) MpNum state_ = {};
+  static constexpr MpNum mont_mul (const MpNum &a, const MpNum &b);
+  static constexpr std::array<MpNum,BITS> mont_step_table ();
+  static constexpr std::array<MpNum,BITS> MONT_STEPS = mont_step_table();
+  constexpr void state_mul (const MpNum &b);
 public:
   /// Construct an instance and call `seed (s)`.
-  explicit Mwc256 (const std::array<uint64_t,4> &s) { seed (s); }
+  constexpr explicit MwcRng (const std::array<uint64_t,4> &s) { seed (s); }
   /// Construct an instance with a fixed seed, dynamic seeding is recommended.
-  explicit Mwc256 () { seed(); }
+  constexpr explicit MwcRng () { seed(); }
   /// Generate a 64 bit random integer using one multiplication and one addition.
-  uint64_t
+  constexpr uint64_t
   next()
   {
     // Based on Public Domain code by Sebastiano Vigna, https://prng.di.unimi.it/
-    const __uint128_t t = MWC256_A3 * __uint128_t (state_[0]) + state_[3];
-    state_[0] = state_[1];
-    state_[1] = state_[2];
-    state_[2] = t;
-    state_[3] = t >> 64;
-    return state_[2];
+    const __uint128_t t = A * __uint128_t (state_[0]) + state_[W - 1];
+    if constexpr (W > 2)
+      state_[0] = state_[1];
+    if constexpr (W > 3)
+      state_[1] = state_[2];
+    state_[W - 2] = t;
+    state_[W - 1] = t >> 64;
+    return state_[W - 2];
   }
-  /// Initialize and mix initial state, ensure the state is within required bounds.
+  /// Fill `dest` with the next `n` values of next(), keeping the state in registers.
+  void
+  fill (uint64_t *dest, size_t n)
+  {
+    // The oldest state word is replaced by the product, so the state words
+    // are renamed in place and the recurrence unrolls by the W - 1 lag words.
+    constexpr size_t L = W - 1;
+    uint64_t x[L], c = state_[L];
+    for (size_t j = 0; j < L; j++)
+      x[j] = state_[j];
+    size_t i;
+    for (i = 0; i + L <= n; i += L)
+      for (size_t j = 0; j < L; j++) {
+        const __uint128_t t = A * __uint128_t (x[j]) + c;
+        dest[i + j] = x[j] = t;
+        c = t >> 64;
+      }
+    for (size_t j = 0; j < L; j++)
+      state_[j] = x[j];
+    state_[L] = c;
+    for (; i < n; i++)
+      dest[i] = next();
+  }
+  /// Fill `nbytes` of `dest` with the native byte representation of next() values, a partial last value is discarded.
   void
+  fill_bytes (void *dest, size_t nbytes)
+  {
+    uint8_t *d = (uint8_t*) dest;
+    if (0 == (uintptr_t (d) & (alignof (uint64_t) - 1))) {
+      fill ((uint64_t*) d, nbytes / 8);
+      d += nbytes / 8 * 8;
+    } else {
+      uint64_t buffer[64];
+      while (d + sizeof (buffer) <= (uint8_t*) dest + nbytes) {
+        fill (buffer, 64);
+        memcpy (d, buffer, sizeof (buffer));
+        d += sizeof (buffer);
+      }
+      const size_t words = ((uint8_t*) dest + nbytes - d) / 8;
+      fill (buffer, words);
+      memcpy (d, buffer, words * 8);
+      d += words * 8;
+    }
+    const size_t rest = (uint8_t*) dest + nbytes - d;
+    if (rest) {
+      const uint64_t v = next();
+      memcpy (d, &v, rest);
+    }
+  }
+  /// Initialize and mix initial state, ensure the state is within required bounds.
+  constexpr void
   seed (uint64_t s0 = 0x626E33B8D04B4331, uint64_t s1 = 0x85839D6EFFBD7DC6, uint64_t s2 = 0x01886F0928403002, uint64_t s3 = 0xF86C6A11D0C18E95)
   {
-    // The state must be initialized so that 0 < state_[3] < MWC256_A3-1
-    state_[0] = s0;
-    state_[1] = s1;
-    state_[2] = s2;
-    state_[3] = s3 > 0 && s3 < MWC256_A3-1 ? s3 : s3 ^ 0xFEC507705E4AE6E5;
+    // Seed words beyond the lag words are folded into the lag words,
+    // the carry must be initialized so that 0 < carry < A-1
+    const uint64_t s[3] = { s0, s1, s2 };
+    state_ = {};
+    for (size_t i = 0; i < 3; i++)
+      state_[i % (W - 1)] ^= s[i];
+    state_[W - 1] = s3 > 0 && s3 < A-1 ? s3 : s3 ^ 0xFEC507705E4AE6E5;
     // Initial shuffling so we do not generate seed as output
     for (size_t i = 0; i < 17; i++)
       next();
   }
-  void
+  constexpr void
   seed (const std::array<uint64_t,4> &s)
   {
     seed (s[0], s[1], s[2], s[3]);
   }
+  /// Access the raw generator state words, the last word holds the carry.
+  constexpr const std::array<uint64_t,W>&
+  state () const
+  {
+    return state_;
+  }
+  /// Advance the state by 2^e calls to next(), using a single modular multiplication for `e < BITS`.
+  constexpr void
+  jump (unsigned e)
+  {
+    MpNum k = MONT_STEPS[e < BITS ? e : BITS - 1];
+    for (unsigned i = BITS - 1; i < e; i++)
+      k = mont_mul (k, k);
+    state_ = mont_mul (state_, k);
+  }
+  /// Advance the state by `n` calls to next(), using one modular multiplication per bit set in `n`.
+  constexpr void
+  discard (__uint128_t n)
+  {
+    for (unsigned i = 0; n; n >>= 1, i++)
+      if (n & 1)
+        state_ = mont_mul (state_, MONT_STEPS[i]);
+  }
+};
+
+/** Internal Montgomery multiplication `a * b / 2^BITS mod m` for inputs `< m`.
+ * The lowest word of m = A * 2^(BITS - 64) - 1 is all ones, so the per word
+ * Montgomery factor `-m^-1 mod 2^64` is 1 and needs no extra multiplication.
+ */
+template<unsigned BITS> constexpr typename MwcRng<BITS>::MpNum
+MwcRng<BITS>::mont_mul (const MpNum &a, const MpNum &b)
+{
+  MpNum mod = {};
+  for (size_t j = 0; j < W - 1; j++)
+    mod[j] = ~uint64_t (0);
+  mod[W - 1] = A - 1;
+  uint64_t t[W + 2] = {};
+  for (size_t i = 0; i < W; i++)
+    {
+      // t += a * b[i]
+      __uint128_t cs = 0;
+      for (size_t j = 0; j < W; j++)
+        {
+          cs = t[j] + __uint128_t (a[j]) * b[i] + uint64_t (cs >> 64);
+          t[j] = cs;
+        }
+      cs = __uint128_t (t[W]) + uint64_t (cs >> 64);
+      t[W] = cs;
+      t[W + 1] = cs >> 64;
+      // t = (t + q * m) / 2^64 with q = t[0]
+      const uint64_t q = t[0];
+      cs = t[0] + __uint128_t (q) * mod[0];
+      for (size_t j = 1; j < W; j++)
+        {
+          cs = t[j] + __uint128_t (q) * mod[j] + uint64_t (cs >> 64);
+          t[j - 1] = cs;
+        }
+      cs = __uint128_t (t[W]) + uint64_t (cs >> 64);
+      t[W - 1] = cs;
+      t[W] = t[W + 1] + uint64_t (cs >> 64);
+    }
+  // t < 2m, subtract m once if needed
+  MpNum d = {}, r = {};
+  uint64_t borrow = 0;
+  for (size_t j = 0; j < W; j++)
+    {
+      const __uint128_t df = __uint128_t (t[j]) - mod[j] - borrow;
+      d[j] = df;
+      borrow = uint64_t (df >> 64) & 1;
+      r[j] = t[j];
+    }
+  if (t[W] || !borrow)
+    return d;
+  return r;
+}
+
+/** Internal table of `2^-64^(2^e) * 2^BITS mod m`, the Montgomery form of the multiplier for 2^e steps.
+ * The table holds all `e < BITS` and is computed by repeated squaring at compile time.
+ */
+template<unsigned BITS> constexpr std::array<typename MwcRng<BITS>::MpNum,BITS>
+MwcRng<BITS>::mont_step_table ()
+{
+  std::array<MpNum,BITS> t = {};
+  // 2^-64 * 2^BITS = 2^(BITS - 64) < m
+  t[0][W - 1] = 1;
+  for (size_t i = 1; i < BITS; i++)
+    t[i] = mont_mul (t[i - 1], t[i - 1]);
+  return t;
+}
+
+/// Internal multi-precision multiplication of the state with `b` for jumps.
+template<unsigned BITS> constexpr void
+MwcRng<BITS>::state_mul (const MpNum &b)
+{
+  state_ = mont_mul (mont_mul (state_, b), MwcTraits<BITS>::MONT_R2);
+}
+
+/** Mwc128 - 128 Bit Multiply-With-Carry PRNG.
+ *
+ * One lag word and one carry word, the period is approximately 2^127.
+ * The state fits into 16 bytes, so four instances share a cache line.
+ */
+class Mwc128 : public MwcRng<128> {
+  static constexpr MpNum JUMP64 = { 0xa72f9a3547208003, 0x2f65fed2e8400983 };
+  static constexpr MpNum JUMP96 = { 0xe6f7814467f3fcdd, 0x394649cfd6769c91 };
+public:
+  using MwcRng<128>::MwcRng;
+  /// Advance the state by 2^64 calls to next(), offsets into up to 2^64 non-overlapping subsequences.
+  constexpr void
+  jump_64()
+  {
+    state_mul (JUMP64);
+  }
+  /// Advance the state by 2^96 calls to next(), offsets into up to 2^32 non-overlapping subsequences.
+  constexpr void
+  jump_96()
+  {
+    state_mul (JUMP96);
+  }
+};
+
+/** Mwc192 - 192 Bit Multiply-With-Carry PRNG.
+ *
+ * Two lag words and one carry word, the period is approximately 2^191.
+ * The state is 24 bytes with 8 byte alignment, instances pack densely into arrays.
+ */
+class Mwc192 : public MwcRng<192> {
+  static constexpr MpNum JUMP96 = { 0xd94fb8d87c7c6437, 0xafc217e3b9edf985, 0xdc2be36e4bd21a2 };
+  static constexpr MpNum JUMP144 = { 0xd0e7cedd16a0758e, 0xec956c3909137b2d, 0x3c6528aaead6bbdd };
+public:
+  using MwcRng<192>::MwcRng;
+  /// Advance the state by 2^96 calls to next(), offsets into up to 2^96 non-overlapping subsequences.
+  constexpr void
+  jump_96()
+  {
+    state_mul (JUMP96);
+  }
+  /// Advance the state by 2^144 calls to next(), offsets into up to 2^48 non-overlapping subsequences.
+  constexpr void
+  jump_144()
+  {
+    state_mul (JUMP144);
+  }
+};
+
+/** Mwc256 - 256 Bit Multiply-With-Carry PRNG.
+ *
+ * This is a Marsaglia multiply-with-carry generator with period
+ * approximately 2^255. It is faster than a scrambled linear
+ * generator, as its only 128-bit operations are a multiplication and sum;
+ * it is an excellent generator based on congruential arithmetic.
+ *
+ * Like all MWC generators, it simulates a multiplicative LCG with prime
+ * modulus m = 0xff377e26f82da749ffffffffffffffffffffffffffffffffffffffffffffffff
+ * and multiplier given by the inverse of 2^64 modulo m. The modulus has a
+ * particular form, which creates some theoretical issues, but at this
+ * size a generator of this kind passes all known statistical tests.
+ */
+class Mwc256 : public MwcRng<256> {
+  static constexpr MpNum JUMP128 = { 0x49ffebb8aed35da, 0x8aeb90fc17d34f8c, 0x3e78ff9958b436d9, 0x377fc42deaad8b46 };
+  static constexpr MpNum JUMP192 = { 0x7cbd7641a0db932f, 0x1eafd94d7d3ac65c, 0xf4fc97e3b80db1b, 0x630e9c671e238c8a };
+public:
+  using MwcRng<256>::MwcRng;
   /// Advance the state by 2^128 calls to next(), offsets into up to 2^128 non-overlapping subsequences.
-  void
+  constexpr void
   jump_128()
   {
-    static constexpr std::array<uint64_t,5> jump128 = { 0x49ffebb8aed35da, 0x8aeb90fc17d34f8c, 0x3e78ff9958b436d9, 0x377fc42deaad8b46, 0 };
-    state_mul256 (jump128);
+    state_mul (JUMP128);
   }
   /// Advance the state by 2^192 calls to next(), offsets into up to 2^64 non-overlapping subsequences.
-  void
+  constexpr void
   jump_192()
   {
-    static constexpr std::array<uint64_t,5> jump192 = { 0x7cbd7641a0db932f, 0x1eafd94d7d3ac65c, 0xf4fc97e3b80db1b, 0x630e9c671e238c8a, 0 };
-    state_mul256 (jump192);
+    state_mul (JUMP192);
   }
 };
 
-/// Internal multi-precision multiplication for jumps.
-inline void
-Mwc256::state_mul256 (const std::array<uint64_t,5> &b)
-{
-  static constexpr int MPQWORDS = 5;
-  using MpNum = std::array<uint64_t,MPQWORDS>;
-  MpNum a = { state_[0], state_[1], state_[2], state_[3], 0 };
-  static constexpr MpNum mwc256_mod = { 0xffffffffffffffff, 0xffffffffffffffff, 0xffffffffffffffff, MWC256_A3 - 1, 0 };
-  const auto mpc_cmp = [] (const MpNum &a, const MpNum &b) {
-    for (int i = MPQWORDS; i-- != 0; ) {
-      if (a[i] < b[i]) return -1;
-      if (a[i] > b[i]) return 1;
+#if defined(__AVX2__)
+/** Mwc256x4 - Four interleaved Mwc256 streams in AVX2 registers.
+ *
+ * Lane `i` starts out as a copy of the seeding Mwc256 advanced by `i` calls
+ * to jump_128(), so the lanes generate non-overlapping subsequences.
+ * Bulk output interleaves the lanes, `dest[4 * k + i]` is the `k`-th value
+ * generated by lane `i`. AVX2 has no 64x64->128 bit multiplication, so each
+ * product is assembled from four 32x32->64 bit multiplications.
+ */
+class Mwc256x4 {
+  __m256i x0_, x1_, x2_, c_;
+  static constexpr uint64_t MWC256_A3 = MwcTraits<256>::A;
+public:
+  static constexpr size_t LANES = 4;
+  /// Construct 4 lanes from `prng` and its jump_128() successors.
+  explicit
+  Mwc256x4 (const Mwc256 &prng)
+  {
+    Mwc256 p = prng;
+    alignas (32) uint64_t s[4][LANES];
+    for (size_t l = 0; l < LANES; l++) {
+      for (size_t j = 0; j < 4; j++)
+        s[j][l] = p.state()[j];
+      p.jump_128();
     }
-    return 0;
-  };
-  const auto mpc_bsub = [] (MpNum &a, const MpNum &b) {
-    int borrow = 0;     // Assumes a >= b
-    for (int i = 0; i < MPQWORDS; i++)
-      {
-        __int128_t d = __int128_t (a[i]) - __int128_t (b[i]) - __int128_t (borrow);
-        borrow = d < 0;
-        a[i] = __int128_t (UINT64_MAX) + 1 + d;
-      }
-  };
-  const auto mpc_rem = [&] (MpNum &a, const MpNum &m) {
-    for (;;)
-      {
-        if (mpc_cmp (a, m) < 0)
-          return;
-        mpc_bsub (a, m);
-      }
-  };
-  const auto mpc_add = [&] (MpNum &a, const MpNum &b, const MpNum &m) {
-    int carry = 0;
-    for (int i = 0; i < MPQWORDS; i++)
-      {
-        __uint128_t s = __uint128_t (a[i]) + __uint128_t (b[i]) + __uint128_t (carry);
-        carry = s > UINT64_MAX;
-        a[i] = s;
-      }
-    mpc_rem (a, m);
-  };
-  MpNum r = {}, t = a;
-  int d;
-  for (d = MPQWORDS; d-- != 0 && b[d] == 0;)
-    ;
-  d++;
-  for (int i = 0; i < d * 64; i++)
-    {
-      if (b[i >> 6] & (UINT64_C (1) << (i & 63)))
-        mpc_add (r, t, mwc256_mod);
-      mpc_add (t, t, mwc256_mod);
+    x0_ = _mm256_load_si256 ((const __m256i*) s[0]);
+    x1_ = _mm256_load_si256 ((const __m256i*) s[1]);
+    x2_ = _mm256_load_si256 ((const __m256i*) s[2]);
+    c_  = _mm256_load_si256 ((const __m256i*) s[3]);
+  }
+  /// Construct 4 lanes from a default seeded Mwc256.
+  explicit Mwc256x4 () : Mwc256x4 (Mwc256()) {}
+  /// Fill `dest` with `n` values from all lanes interleaved, a partial last row is discarded.
+  void
+  fill (uint64_t *dest, size_t n)
+  {
+    const __m256i lo32 = _mm256_set1_epi64x (0xffffffff);
+    const __m256i al = _mm256_set1_epi64x (MWC256_A3 & 0xffffffff), ah = _mm256_set1_epi64x (MWC256_A3 >> 32);
+    __m256i x0 = x0_, x1 = x1_, x2 = x2_, c = c_, lo;
+    const auto step = [&] () {
+      // t = A3 * x0 + c, using 32 bit partial products
+      const __m256i xh = _mm256_srli_epi64 (x0, 32);
+      const __m256i p0 = _mm256_mul_epu32 (x0, al), p1 = _mm256_mul_epu32 (xh, al);
+      const __m256i p2 = _mm256_mul_epu32 (x0, ah), p3 = _mm256_mul_epu32 (xh, ah);
+      const __m256i l = _mm256_add_epi64 (_mm256_and_si256 (p0, lo32), _mm256_and_si256 (c, lo32));
+      __m256i m = _mm256_add_epi64 (_mm256_add_epi64 (_mm256_srli_epi64 (p0, 32), _mm256_and_si256 (p1, lo32)),
+                                    _mm256_add_epi64 (_mm256_and_si256 (p2, lo32), _mm256_srli_epi64 (c, 32)));
+      m = _mm256_add_epi64 (m, _mm256_srli_epi64 (l, 32));
+      lo = _mm256_or_si256 (_mm256_and_si256 (l, lo32), _mm256_slli_epi64 (m, 32));
+      const __m256i hi = _mm256_add_epi64 (_mm256_add_epi64 (p3, _mm256_srli_epi64 (p1, 32)),
+                                           _mm256_add_epi64 (_mm256_srli_epi64 (p2, 32), _mm256_srli_epi64 (m, 32)));
+      x0 = x1;
+      x1 = x2;
+      x2 = lo;
+      c = hi;
+    };
+    size_t i;
+    for (i = 0; i + LANES <= n; i += LANES) {
+      step();
+      _mm256_storeu_si256 ((__m256i*) (dest + i), lo);
     }
-  state_[0] = r[0];
-  state_[1] = r[1];
-  state_[2] = r[2];
-  state_[3] = r[3];
-}
+    if (i < n) {
+      alignas (32) uint64_t rest[LANES];
+      step();
+      _mm256_store_si256 ((__m256i*) rest, lo);
+      memcpy (dest + i, rest, (n - i) * sizeof (rest[0]));
+    }
+    x0_ = x0; x1_ = x1; x2_ = x2; c_ = c;
+  }
+};
+#endif // __AVX2__
+
+#if defined(__AVX512F__)
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ == 12
+// Silence GCC-12 false positives about _mm512_undefined_epi32(), see https://gcc.gnu.org/PR105593
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+/** Mwc256x8 - Eight interleaved Mwc256 streams in AVX-512 registers.
+ *
+ * The lane layout and output order matches Mwc256x4, with 8 lanes
+ * seeded by successive jump_128() calls.
+ */
+class Mwc256x8 {
+  __m512i x0_, x1_, x2_, c_;
+  static constexpr uint64_t MWC256_A3 = MwcTraits<256>::A;
+public:
+  static constexpr size_t LANES = 8;
+  /// Construct 8 lanes from `prng` and its jump_128() successors.
+  explicit
+  Mwc256x8 (const Mwc256 &prng)
+  {
+    Mwc256 p = prng;
+    alignas (64) uint64_t s[4][LANES];
+    for (size_t l = 0; l < LANES; l++) {
+      for (size_t j = 0; j < 4; j++)
+        s[j][l] = p.state()[j];
+      p.jump_128();
+    }
+    x0_ = _mm512_load_si512 (s[0]);
+    x1_ = _mm512_load_si512 (s[1]);
+    x2_ = _mm512_load_si512 (s[2]);
+    c_  = _mm512_load_si512 (s[3]);
+  }
+  /// Construct 8 lanes from a default seeded Mwc256.
+  explicit Mwc256x8 () : Mwc256x8 (Mwc256()) {}
+  /// Fill `dest` with `n` values from all lanes interleaved, a partial last row is discarded.
+  void
+  fill (uint64_t *dest, size_t n)
+  {
+    const __m512i lo32 = _mm512_set1_epi64 (0xffffffff);
+    const __m512i al = _mm512_set1_epi64 (MWC256_A3 & 0xffffffff), ah = _mm512_set1_epi64 (MWC256_A3 >> 32);
+    __m512i x0 = x0_, x1 = x1_, x2 = x2_, c = c_, lo;
+    const auto step = [&] () {
+      // t = A3 * x0 + c, using 32 bit partial products
+      const __m512i xh = _mm512_srli_epi64 (x0, 32);
+      const __m512i p0 = _mm512_mul_epu32 (x0, al), p1 = _mm512_mul_epu32 (xh, al);
+      const __m512i p2 = _mm512_mul_epu32 (x0, ah), p3 = _mm512_mul_epu32 (xh, ah);
+      const __m512i l = _mm512_add_epi64 (_mm512_and_si512 (p0, lo32), _mm512_and_si512 (c, lo32));
+      __m512i m = _mm512_add_epi64 (_mm512_add_epi64 (_mm512_srli_epi64 (p0, 32), _mm512_and_si512 (p1, lo32)),
+                                    _mm512_add_epi64 (_mm512_and_si512 (p2, lo32), _mm512_srli_epi64 (c, 32)));
+      m = _mm512_add_epi64 (m, _mm512_srli_epi64 (l, 32));
+      lo = _mm512_or_si512 (_mm512_and_si512 (l, lo32), _mm512_slli_epi64 (m, 32));
+      const __m512i hi = _mm512_add_epi64 (_mm512_add_epi64 (p3, _mm512_srli_epi64 (p1, 32)),
+                                           _mm512_add_epi64 (_mm512_srli_epi64 (p2, 32), _mm512_srli_epi64 (m, 32)));
+      x0 = x1;
+      x1 = x2;
+      x2 = lo;
+      c = hi;
+    };
+    size_t i;
+    for (i = 0; i + LANES <= n; i += LANES) {
+      step();
+      _mm512_storeu_si512 (dest + i, lo);
+    }
+    if (i < n) {
+      alignas (64) uint64_t rest[LANES];
+      step();
+      _mm512_store_si512 (rest, lo);
+      memcpy (dest + i, rest, (n - i) * sizeof (rest[0]));
+    }
+    x0_ = x0; x1_ = x1; x2_ = x2; c_ = c;
+  }
+};
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ == 12
+#pragma GCC diagnostic pop
+#endif
+#endif // __AVX512F__
 
 } // scl
 
@@ -8,42 +8,194 @@
 #include <sys/random.h>
 
 #include "shishua.cc"
+#include "../generate-threaded.hh"
 
 /// Return the current time as uint64 in nanoseconds.
 extern inline uint64_t timestamp_nsecs() { return std::chrono::steady_clock::now().time_since_epoch().count(); }
 
-static size_t
-generate_bytes (const std::array<uint64_t, 4> &seeds, const uint64_t nbytes, unsigned kind, FILE *fout)
+/** Time fills of a buffer larger than the last level cache and a consumer pass over a separate working set.
+ * With regular stores the fill evicts the working set, non-temporal stores leave it cache resident.
+ */
+template<class Fill> static void
+llc_consumer_bench (const char *what, const Fill &fill)
+{
+  constexpr size_t FILL = 512 * 1024 * 1024, WSET = 16 * 1024 * 1024, ROUNDS = 4, LINES = WSET / 64;
+  std::vector<uint64_t> wset (WSET / 8, 1);
+  uint8_t *const buffer = (uint8_t*) aligned_alloc (64, FILL);
+  memset (buffer, 0, FILL); // fault in pages
+  uint64_t tfill = 0, tuse = 0, sum = 0;
+  for (size_t r = 0; r < ROUNDS; r++) {
+    for (size_t i = 0; i < LINES; i++) // one access per cache line, in an order the prefetchers cannot follow
+      sum += wset[(i * 0x9E3779B1 & (LINES - 1)) * 8];
+    const uint64_t t1 = timestamp_nsecs();
+    fill (buffer, FILL);
+    const uint64_t t2 = timestamp_nsecs();
+    for (size_t i = 0; i < LINES; i++)
+      sum += wset[(i * 0x9E3779B1 & (LINES - 1)) * 8];
+    const uint64_t t3 = timestamp_nsecs();
+    tfill += t2 - t1;
+    tuse += t3 - t2;
+  }
+  free (buffer);
+  assert (sum == ROUNDS * 2 * LINES);
+  dprintf (2, " %-28s %f GB/sec fill, %.3f msecs consumer pass over a %zu MB working set\n", what,
+           ROUNDS * FILL * (1000000000.0 / (1024*1024*1024)) / tfill, tuse / 1000000.0 / ROUNDS, WSET >> 20);
+}
+
+/// Derive the seeds for the substream of worker `w`, worker 0 uses the original `seeds`.
+/// Every seed word gets a SplitMix64 step keyed by `w`, so substreams of adjacent seeds do not coincide.
+static std::array<uint64_t, 4>
+substream_seeds (std::array<uint64_t, 4> seeds, unsigned w)
+{
+  if (w == 0)
+    return seeds;
+  for (size_t i = 0; i < 4; i++) {
+    uint64_t z = seeds[i] + (4 * uint64_t (w) + i) * 0x9e3779b97f4a7c15ull;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    seeds[i] = z ^ (z >> 31);
+  }
+  return seeds;
+}
+
+/// Generate with `threads` workers, each running the Shishua variant given by `State`, `init` and `gen` on its own substream.
+template<class State, void (*init) (State*, const uint64_t*), void (*gen) (State*, uint8_t*, size_t)> static uint64_t
+generate_substreams (const std::array<uint64_t, 4> &seeds, const uint64_t nbytes, unsigned threads, size_t chunk, FILE *fout)
+{
+  return generate_threaded (threads, nbytes, chunk, fout, [&] (unsigned w) {
+    State state{};
+    init (&state, substream_seeds (seeds, w).data());
+    return [state, chunk] (uint64_t, uint8_t *dest) mutable { gen (&state, dest, chunk); };
+  });
+}
+
+/// Generate `nbytes` with the Shishua variant given by `State`, `init` and `gen` in the calling thread.
+template<class State, void (*init) (State*, const uint64_t*), void (*gen) (State*, uint8_t*, size_t)> static uint64_t
+generate_state (const std::array<uint64_t, 4> &seeds, const uint64_t nbytes, FILE *fout)
 {
   const unsigned N = std::min (nbytes, 64 * 1024 * 1024ul);
   std::vector<uint8_t> buffer (N, 0);
+  State state{};
+  init (&state, seeds.data());
   uint64_t nb;
-  if (kind >= 4) { // Avx2
-    Shishua::Avx2::prng_state state{};
-    Shishua::Avx2::prng_init (&state, seeds.data());
-    for (nb = 0; nb < nbytes; nb += buffer.size()) {
-      Shishua::Avx2::prng_gen (&state, buffer.data(), buffer.size());
-      if (fout)
-        fwrite (buffer.data(), buffer.size(), 1, fout);
-    }
-  } else if (kind >= 2) { // Sse2
-    Shishua::Sse2::prng_state state{};
-    Shishua::Sse2::prng_init (&state, seeds.data());
-    for (nb = 0; nb < nbytes; nb += buffer.size()) {
-      Shishua::Sse2::prng_gen (&state, buffer.data(), buffer.size());
-      if (fout)
-        fwrite (buffer.data(), buffer.size(), 1, fout);
-    }
-  } else { // (kind >= 1) // scalar
-    Shishua::Scalar::prng_state state{};
-    Shishua::Scalar::prng_init (&state, seeds.data());
+  for (nb = 0; nb < nbytes; nb += buffer.size()) {
+    gen (&state, buffer.data(), buffer.size());
+    if (fout)
+      fwrite (buffer.data(), buffer.size(), 1, fout);
+  }
+  return nb;
+}
+
+static size_t
+generate_bytes (const std::array<uint64_t, 4> &seeds, const uint64_t nbytes, unsigned kind, unsigned threads, FILE *fout)
+{
+  using namespace Shishua;
+  if (threads) {
+    const size_t CHUNK = 1024 * 1024;
+#if defined(SHISHUA_HAVE_AVX512)
+    if (kind >= 8 && Avx512::supported())
+      return generate_substreams<Avx512::prng_state, Avx512::prng_init, Avx512::prng_gen> (seeds, nbytes, threads, CHUNK, fout);
+#endif
+    if (kind >= 4)
+      return generate_substreams<Avx2::prng_state, Avx2::prng_init, Avx2::prng_gen> (seeds, nbytes, threads, CHUNK, fout);
+    if (kind >= 2)
+      return generate_substreams<Sse2::prng_state, Sse2::prng_init, Sse2::prng_gen> (seeds, nbytes, threads, CHUNK, fout);
+    return generate_substreams<Scalar::prng_state, Scalar::prng_init, Scalar::prng_gen> (seeds, nbytes, threads, CHUNK, fout);
+  }
+#if defined(SHISHUA_HAVE_AVX512)
+  if (kind >= 8 && Avx512::supported())
+    return generate_state<Avx512::prng_state, Avx512::prng_init, Avx512::prng_gen> (seeds, nbytes, fout);
+#endif
+  if (kind == 5) { // Avx2, two interleaved states
+    const unsigned N = std::min (nbytes, 64 * 1024 * 1024ul);
+    std::vector<uint8_t> buffer (N, 0);
+    Avx2::prng_state a{}, b{};
+    Avx2::prng_init (&a, seeds.data());
+    Avx2::prng_init (&b, substream_seeds (seeds, 1).data());
+    uint64_t nb;
     for (nb = 0; nb < nbytes; nb += buffer.size()) {
-      Shishua::Scalar::prng_gen (&state, buffer.data(), buffer.size());
+      Avx2::prng_gen_dual (&a, &b, buffer.data(), buffer.size());
       if (fout)
         fwrite (buffer.data(), buffer.size(), 1, fout);
     }
+    return nb;
   }
-  return nb;
+  if (kind >= 4)
+    return generate_state<Avx2::prng_state, Avx2::prng_init, Avx2::prng_gen> (seeds, nbytes, fout);
+  if (kind >= 2)
+    return generate_state<Sse2::prng_state, Sse2::prng_init, Sse2::prng_gen> (seeds, nbytes, fout);
+  return generate_state<Scalar::prng_state, Scalar::prng_init, Scalar::prng_gen> (seeds, nbytes, fout);
+}
+
+/// Like generate_bytes() for the half width variant, which has no AVX-512 or dual state kernel.
+static size_t
+generate_half_bytes (const std::array<uint64_t, 4> &seeds, const uint64_t nbytes, unsigned kind, unsigned threads, FILE *fout)
+{
+  using namespace ShishuaHalf;
+  const size_t CHUNK = 1024 * 1024;
+#if defined(__AVX2__)
+  if (kind >= 4)
+    return threads ? generate_substreams<Avx2::prng_state, Avx2::prng_init, Avx2::prng_gen> (seeds, nbytes, threads, CHUNK, fout) :
+      generate_state<Avx2::prng_state, Avx2::prng_init, Avx2::prng_gen> (seeds, nbytes, fout);
+#endif
+#if defined(__SSE2__)
+  if (kind >= 2)
+    return threads ? generate_substreams<Sse2::prng_state, Sse2::prng_init, Sse2::prng_gen> (seeds, nbytes, threads, CHUNK, fout) :
+      generate_state<Sse2::prng_state, Sse2::prng_init, Sse2::prng_gen> (seeds, nbytes, fout);
+#endif
+  return threads ? generate_substreams<Scalar::prng_state, Scalar::prng_init, Scalar::prng_gen> (seeds, nbytes, threads, CHUNK, fout) :
+    generate_state<Scalar::prng_state, Scalar::prng_init, Scalar::prng_gen> (seeds, nbytes, fout);
+}
+
+static void
+shishua_threaded_tests (const std::array<uint64_t, 4> &seeds)
+{
+  using namespace Shishua;
+  constexpr size_t T = 3, CHUNK = 1024, NCHUNKS = 50;
+  char *mem = nullptr;
+  size_t memsize = 0;
+  FILE *fmem = open_memstream (&mem, &memsize);
+  const size_t total = generate_substreams<Scalar::prng_state, Scalar::prng_init, Scalar::prng_gen> (seeds, NCHUNKS * CHUNK, T, CHUNK, fmem);
+  fclose (fmem);
+  assert (total == NCHUNKS * CHUNK && memsize == total);
+  std::vector<uint8_t> chunk (CHUNK);
+  Scalar::prng_state states[T];
+  for (size_t w = 0; w < T; w++)
+    Scalar::prng_init (&states[w], substream_seeds (seeds, w).data());
+  for (size_t k = 0; k < NCHUNKS; k++) {
+    Scalar::prng_gen (&states[k % T], chunk.data(), CHUNK);
+    assert (0 == memcmp (mem + k * CHUNK, chunk.data(), CHUNK));
+  }
+  free (mem);
+  printf ("  OK    Shishua substreams reassembled from %zu threads\n", T);
+  std::array<uint64_t, 4> next = seeds;
+  next[3] += 1;
+  for (size_t w = 1; w < T; w++)
+    for (size_t v = 0; v < T; v++)
+      assert (substream_seeds (seeds, w) != substream_seeds (next, v));
+  printf ("  OK    Shishua substreams of adjacent seeds differ\n");
+}
+
+/// Print the states per second of prng_init() for each state and of prng_init_many() for variant `name`.
+template<class State, void (*init) (State*, const uint64_t*), void (*init_many) (State*, const uint64_t*, size_t)> static void
+bench_init_many (const char *name, const char *how, const std::array<uint64_t, 4> &seeds)
+{
+  constexpr size_t N = 4096, ROUNDS = 64;
+  std::vector<uint64_t> many_seeds (4 * N);
+  for (size_t i = 0; i < many_seeds.size(); i++)
+    many_seeds[i] = seeds[i % 4] + i;
+  std::vector<State> states (N);
+  dprintf (2, "BENCH: %s initialization of %zu states, prng_init_many() is %s\n", name, N, how);
+  auto t1 = timestamp_nsecs();
+  for (size_t r = 0; r < ROUNDS; r++)
+    for (size_t i = 0; i < N; i++)
+      init (&states[i], &many_seeds[4 * i]);
+  auto t2 = timestamp_nsecs();
+  for (size_t r = 0; r < ROUNDS; r++)
+    init_many (states.data(), many_seeds.data(), N);
+  auto t3 = timestamp_nsecs();
+  dprintf (2, " prng_init()      %.3f M states/sec\n", N * ROUNDS * 1000.0 / (t2 - t1));
+  dprintf (2, " prng_init_many() %.3f M states/sec, speedup: %.2fx\n", N * ROUNDS * 1000.0 / (t3 - t2), (t2 - t1) / double (t3 - t2));
 }
 
 int
@@ -55,10 +207,18 @@ main (int argc, const char *argv[])
 
   double streamlen = 0;
   unsigned kind = ~0; // ALU
+  unsigned threads = 0; // generate in the calling thread
+  bool bench_nt = false, bench_init = false, half = false;
   for (int i = 1; i < argc; i++)
     if (0 == strcasecmp (argv[i], "--check")) {
       shishua_tests (seeds);
       shishua_stream_tests (seeds);
+      shishua_init_many_tests<Shishua::Scalar::prng_state, Shishua::Scalar::prng_init, Shishua::Scalar::prng_init_many> ("Scalar");
+      shishua_init_many_tests<Shishua::Sse2::prng_state, Shishua::Sse2::prng_init, Shishua::Sse2::prng_init_many> ("Sse2");
+      shishua_init_many_tests<Shishua::Avx2::prng_state, Shishua::Avx2::prng_init, Shishua::Avx2::prng_init_many> ("Avx2");
+      shishua_rng_tests (seeds);
+      shishua_half_tests (seeds);
+      shishua_threaded_tests (seeds);
       return 0;
     } else if (0 == strcasecmp (argv[i], "--sse"))
       kind = 2; // SSE
@@ -66,6 +226,18 @@ main (int argc, const char *argv[])
       kind = 1; // ALU
     else if (0 == strcasecmp (argv[i], "--avx"))
       kind = 4; // AVX2
+    else if (0 == strcasecmp (argv[i], "--dual"))
+      kind = 5; // AVX2, two interleaved states
+    else if (0 == strcasecmp (argv[i], "--half"))
+      half = true; // half width state
+    else if (0 == strcasecmp (argv[i], "--avx512"))
+      kind = 8; // AVX512, if supported by the CPU
+    else if (0 == strcasecmp (argv[i], "--threads") && i+1 < argc)
+      threads = std::max (1ul, strtoul (argv[++i], nullptr, 0));
+    else if (0 == strcasecmp (argv[i], "--bench-init"))
+      bench_init = true;
+    else if (0 == strcasecmp (argv[i], "--bench-nt"))
+      bench_nt = true;
     else if (0 == strcasecmp (argv[i], "--seed") && i+1 < argc) {
       seeds = std::array<uint64_t, 4>{};
       seeds[0] = strtoull (argv[++i], nullptr, 0);
@@ -83,16 +255,45 @@ main (int argc, const char *argv[])
           }
     }
 
-  if (streamlen > 0) {
+  if (bench_init) {
+    bench_init_many<Shishua::Scalar::prng_state, Shishua::Scalar::prng_init, Shishua::Scalar::prng_init_many> ("Scalar", "a plain loop", seeds);
+    bench_init_many<Shishua::Sse2::prng_state, Shishua::Sse2::prng_init, Shishua::Sse2::prng_init_many> ("SSE2", "a plain loop", seeds);
+    bench_init_many<Shishua::Avx2::prng_state, Shishua::Avx2::prng_init, Shishua::Avx2::prng_init_many> ("AVX2", "batched, 2 states interleaved", seeds);
+  }
+  else if (bench_nt) {
+    Shishua::Avx2::prng_state state{};
+    Shishua::Avx2::prng_init (&state, seeds.data());
+    dprintf (2, "BENCH: AVX2 fills with regular and non-temporal stores\n");
+    llc_consumer_bench ("prng_gen()", [&] (uint8_t *buf, size_t n) { Shishua::Avx2::prng_gen (&state, buf, n); });
+    llc_consumer_bench ("prng_gen_stream()", [&] (uint8_t *buf, size_t n) { Shishua::Avx2::prng_gen_stream (&state, buf, n); });
+    llc_consumer_bench ("prng_gen_stream() unaligned", [&] (uint8_t *buf, size_t n) { Shishua::Avx2::prng_gen_stream (&state, buf + 16, n - 128); });
+  }
+  else if (streamlen > 0) {
     streamlen = std::min (streamlen, 0x1p+63); // 2^63 = 9223372036854775808
     dprintf (2, "BENCH: %zu Bytes\n", size_t (streamlen));
     auto t1 = timestamp_nsecs();
-    const size_t total = generate_bytes (seeds, uint64_t (streamlen), kind, nullptr);
+    const size_t total = (half ? generate_half_bytes : generate_bytes) (seeds, uint64_t (streamlen), kind, threads, nullptr);
     auto t2 = timestamp_nsecs();
     dprintf (2, " %.3f msecs (%zu Bytes), %f GB/sec\n", (t2 - t1) / 1000000.0, total, total * (1000000000.0 / (1024*1024*1024)) / (t2 - t1));
+    if (half) { // compare with the full width variant
+      auto t3 = timestamp_nsecs();
+      const size_t total1 = generate_bytes (seeds, uint64_t (streamlen), std::min (kind, 4u), threads, nullptr);
+      auto t4 = timestamp_nsecs();
+      const size_t state_size = kind >= 4 ? sizeof (ShishuaHalf::Avx2::prng_state) : kind >= 2 ? sizeof (ShishuaHalf::Sse2::prng_state) : sizeof (ShishuaHalf::Scalar::prng_state);
+      const size_t state_size1 = kind >= 4 ? sizeof (Shishua::Avx2::prng_state) : kind >= 2 ? sizeof (Shishua::Sse2::prng_state) : sizeof (Shishua::Scalar::prng_state);
+      dprintf (2, " %.3f msecs (%zu Bytes), %f GB/sec with the full width state, state size: %zu vs %zu bytes, throughput ratio: %.2f\n",
+               (t4 - t3) / 1000000.0, total1, total1 * (1000000000.0 / (1024*1024*1024)) / (t4 - t3), state_size, state_size1, (t4 - t3) / double (t2 - t1));
+    }
+    if (kind == 5 && !threads) { // compare with the single state kernel
+      auto t3 = timestamp_nsecs();
+      const size_t total1 = generate_bytes (seeds, uint64_t (streamlen), 4, threads, nullptr);
+      auto t4 = timestamp_nsecs();
+      dprintf (2, " %.3f msecs (%zu Bytes), %f GB/sec with a single state, dual state speedup: %.2fx\n", (t4 - t3) / 1000000.0, total1,
+               total1 * (1000000000.0 / (1024*1024*1024)) / (t4 - t3), (t4 - t3) / double (t2 - t1));
+    }
   }
   else
-    generate_bytes (seeds, uint64_t (0x1p+63), kind, stdout);
+    (half ? generate_half_bytes : generate_bytes) (seeds, uint64_t (0x1p+63), kind, threads, stdout);
 
   return 0;
 }
@@ -9,6 +9,7 @@
 #include <string.h>
 #include <immintrin.h>
 #include <assert.h>
+#include <algorithm>
 
 namespace Shishua::Avx2 {
 
@@ -18,8 +19,18 @@ typedef struct prng_state {
   __m256i counter;
 } prng_state;
 
-// buf's size must be a multiple of 128 bytes.
-static inline void prng_gen(prng_state *s, uint8_t buf[], size_t size) {
+// Store 32 bytes, with a non-temporal store that bypasses the caches for STREAM.
+template<bool STREAM>
+static inline void store256(uint8_t *p, __m256i v) {
+  if constexpr (STREAM)
+    _mm256_stream_si256((__m256i*)p, v);
+  else
+    _mm256_storeu_si256((__m256i*)p, v);
+}
+
+// buf's size must be a multiple of 128 bytes, for STREAM buf must be 32 byte aligned.
+template<bool STREAM>
+static inline void prng_gen_impl(prng_state *s, uint8_t buf[], size_t size) {
   __m256i o0 = s->output[0], o1 = s->output[1], o2 = s->output[2], o3 = s->output[3],
           s0 =  s->state[0], s1 =  s->state[1], s2 =  s->state[2], s3 =  s->state[3],
           t0, t1, t2, t3, u0, u1, u2, u3, counter = s->counter;
@@ -42,15 +53,15 @@ static inline void prng_gen(prng_state *s, uint8_t buf[], size_t size) {
   // I used the smallest odd numbers to avoid having a magic number.
   __m256i increment = _mm256_set_epi64x(1, 3, 5, 7);
 
-  // TODO: consider adding proper uneven write handling
+  // Whole 128 byte blocks only, Shishua::Rng buffers them for byte granular output.
   assert((size % 128 == 0) && "buf's size must be a multiple of 128 bytes.");
 
   for (size_t i = 0; i < size; i += 128) {
     if (buf != NULL) {
-      _mm256_storeu_si256((__m256i*)&buf[i +  0], o0);
-      _mm256_storeu_si256((__m256i*)&buf[i + 32], o1);
-      _mm256_storeu_si256((__m256i*)&buf[i + 64], o2);
-      _mm256_storeu_si256((__m256i*)&buf[i + 96], o3);
+      store256<STREAM>(&buf[i +  0], o0);
+      store256<STREAM>(&buf[i + 32], o1);
+      store256<STREAM>(&buf[i + 64], o2);
+      store256<STREAM>(&buf[i + 96], o3);
     }
 
     // I apply the counter to s1,
@@ -86,6 +97,97 @@ static inline void prng_gen(prng_state *s, uint8_t buf[], size_t size) {
   s->counter = counter;
 }
 
+// buf's size must be a multiple of 128 bytes.
+static inline void prng_gen(prng_state *s, uint8_t buf[], size_t size) {
+  prng_gen_impl<false>(s, buf, size);
+}
+
+// Copy n bytes with non-temporal stores for all 32 byte aligned parts of dst.
+static inline void stream_copy(uint8_t *dst, const uint8_t *src, size_t n) {
+  size_t head = std::min(n, (32 - ((uintptr_t)dst & 31)) & 31), i;
+  memcpy(dst, src, head);
+  for (i = head; i + 32 <= n; i += 32)
+    _mm256_stream_si256((__m256i*)&dst[i], _mm256_loadu_si256((const __m256i*)&src[i]));
+  memcpy(dst + i, src + i, n - i);
+}
+
+// Same output as prng_gen(), but written with non-temporal stores so large
+// fills do not evict the working set of consumers from the last level cache.
+// An unaligned buf is filled via an L1 resident bounce buffer with
+// non-temporal copies, cached stores are only used for its head and tail.
+// buf's size must be a multiple of 128 bytes.
+static inline void prng_gen_stream(prng_state *s, uint8_t buf[], size_t size) {
+  if (((uintptr_t)buf & 31) == 0)
+    prng_gen_impl<true>(s, buf, size);
+  else {
+    alignas(32) uint8_t bounce[4096];
+    for (size_t i = 0, n; i < size; i += n) {
+      n = std::min(size - i, sizeof(bounce));
+      prng_gen_impl<false>(s, bounce, n);
+      stream_copy(buf + i, bounce, n);
+    }
+  }
+  _mm_sfence(); // order the weakly ordered stores before later stores, e.g. to flags
+}
+
+// One prng_gen() iteration on values held in registers, used by prng_gen_dual().
+__attribute__((always_inline))
+static inline void prng_step(__m256i &s0, __m256i &s1, __m256i &s2, __m256i &s3,
+                             __m256i &o0, __m256i &o1, __m256i &o2, __m256i &o3, __m256i &counter) {
+  const __m256i shu0 = _mm256_set_epi32(4, 3, 2, 1, 0, 7, 6, 5),
+                shu1 = _mm256_set_epi32(2, 1, 0, 7, 6, 5, 4, 3);
+  const __m256i increment = _mm256_set_epi64x(1, 3, 5, 7);
+  s1 = _mm256_add_epi64(s1, counter);
+  s3 = _mm256_add_epi64(s3, counter);
+  counter = _mm256_add_epi64(counter, increment);
+  const __m256i u0 = _mm256_srli_epi64(s0, 1),              u1 = _mm256_srli_epi64(s1, 3),
+                u2 = _mm256_srli_epi64(s2, 1),              u3 = _mm256_srli_epi64(s3, 3);
+  const __m256i t0 = _mm256_permutevar8x32_epi32(s0, shu0), t1 = _mm256_permutevar8x32_epi32(s1, shu1),
+                t2 = _mm256_permutevar8x32_epi32(s2, shu0), t3 = _mm256_permutevar8x32_epi32(s3, shu1);
+  s0 = _mm256_add_epi64(t0, u0);              s1 = _mm256_add_epi64(t1, u1);
+  s2 = _mm256_add_epi64(t2, u2);              s3 = _mm256_add_epi64(t3, u3);
+  o0 = _mm256_xor_si256(u0, t1);
+  o1 = _mm256_xor_si256(u2, t3);
+  o2 = _mm256_xor_si256(s0, s3);
+  o3 = _mm256_xor_si256(s2, s1);
+}
+
+// Advance two independent states in one loop, so the permute latency of one
+// chain is hidden behind the other. Stream layout: buf consists of 256 byte
+// rows, the first 128 bytes of each row are the next block of `a`, the second
+// 128 bytes the next block of `b`. So the even 128 byte blocks of buf equal
+// prng_gen(a, ...) and the odd blocks equal prng_gen(b, ...), each advances by
+// size / 256 blocks. buf's size must be a multiple of 256 bytes.
+static inline void prng_gen_dual(prng_state *a, prng_state *b, uint8_t buf[], size_t size) {
+  __m256i ao0 = a->output[0], ao1 = a->output[1], ao2 = a->output[2], ao3 = a->output[3],
+          as0 =  a->state[0], as1 =  a->state[1], as2 =  a->state[2], as3 =  a->state[3], acounter = a->counter;
+  __m256i bo0 = b->output[0], bo1 = b->output[1], bo2 = b->output[2], bo3 = b->output[3],
+          bs0 =  b->state[0], bs1 =  b->state[1], bs2 =  b->state[2], bs3 =  b->state[3], bcounter = b->counter;
+
+  assert((size % 256 == 0) && "buf's size must be a multiple of 256 bytes.");
+
+  for (size_t i = 0; i < size; i += 256) {
+    if (buf != NULL) {
+      _mm256_storeu_si256((__m256i*)&buf[i +   0], ao0);
+      _mm256_storeu_si256((__m256i*)&buf[i +  32], ao1);
+      _mm256_storeu_si256((__m256i*)&buf[i +  64], ao2);
+      _mm256_storeu_si256((__m256i*)&buf[i +  96], ao3);
+      _mm256_storeu_si256((__m256i*)&buf[i + 128], bo0);
+      _mm256_storeu_si256((__m256i*)&buf[i + 160], bo1);
+      _mm256_storeu_si256((__m256i*)&buf[i + 192], bo2);
+      _mm256_storeu_si256((__m256i*)&buf[i + 224], bo3);
+    }
+    prng_step(as0, as1, as2, as3, ao0, ao1, ao2, ao3, acounter);
+    prng_step(bs0, bs1, bs2, bs3, bo0, bo1, bo2, bo3, bcounter);
+  }
+  a->output[0] = ao0; a->output[1] = ao1; a->output[2] = ao2; a->output[3] = ao3;
+  a->state [0] = as0; a->state [1] = as1; a->state [2] = as2; a->state [3] = as3;
+  a->counter = acounter;
+  b->output[0] = bo0; b->output[1] = bo1; b->output[2] = bo2; b->output[3] = bo3;
+  b->state [0] = bs0; b->state [1] = bs1; b->state [2] = bs2; b->state [3] = bs3;
+  b->counter = bcounter;
+}
+
 // Nothing up my sleeve: those are the hex digits of Φ,
 // the least approximable irrational number.
 // $ echo 'scale=310;obase=16;(sqrt(5)-1)/2' | bc
@@ -114,6 +216,44 @@ static inline void prng_init(prng_state *s, const uint64_t seed[4]) {
   }
 }
 
+// Initialize K states at once with all values held in registers,
+// the independent chains of the states hide each other's latency.
+template<size_t K>
+static inline void prng_init_lanes(prng_state *states, const uint64_t *seeds) {
+  __m256i s[K][4], o[K][4], counter[K];
+  for (size_t k = 0; k < K; k++) {
+    const uint64_t *seed = seeds + 4 * k;
+    s[k][0] = _mm256_set_epi64x(phi[ 3], phi[ 2] ^ seed[1], phi[ 1], phi[ 0] ^ seed[0]);
+    s[k][1] = _mm256_set_epi64x(phi[ 7], phi[ 6] ^ seed[3], phi[ 5], phi[ 4] ^ seed[2]);
+    s[k][2] = _mm256_set_epi64x(phi[11], phi[10] ^ seed[3], phi[ 9], phi[ 8] ^ seed[2]);
+    s[k][3] = _mm256_set_epi64x(phi[15], phi[14] ^ seed[1], phi[13], phi[12] ^ seed[0]);
+    counter[k] = _mm256_setzero_si256();
+  }
+  constexpr unsigned ROUNDS = 13;
+  for (size_t i = 0; i < ROUNDS; i++)
+    for (size_t k = 0; k < K; k++) {
+      prng_step(s[k][0], s[k][1], s[k][2], s[k][3], o[k][0], o[k][1], o[k][2], o[k][3], counter[k]);
+      s[k][0] = o[k][3]; s[k][1] = o[k][2];
+      s[k][2] = o[k][1]; s[k][3] = o[k][0];
+    }
+  for (size_t k = 0; k < K; k++) {
+    for (size_t j = 0; j < 4; j++) {
+      states[k].state[j] = s[k][j];
+      states[k].output[j] = o[k][j];
+    }
+    states[k].counter = counter[k];
+  }
+}
+
+// Same as calling prng_init(&states[i], seeds + 4 * i) for all i < n.
+static inline void prng_init_many(prng_state *states, const uint64_t *seeds, size_t n) {
+  size_t i;
+  for (i = 0; i + 2 <= n; i += 2)
+    prng_init_lanes<2>(states + i, seeds + 4 * i);
+  for (; i < n; i++)
+    prng_init_lanes<1>(states + i, seeds + 4 * i);
+}
+
 } // Shishua::Avx2
 
 #endif // SHISHUA_AVX2_H
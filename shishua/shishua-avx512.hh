@@ -0,0 +1,111 @@
+// Dedicated to the Public Domain under the Unlicense: https://unlicense.org/UNLICENSE
+
+// AVX-512 restructuring of https://github.com/espadrine/shishua/blob/master/shishua-avx2.h
+
+#ifndef SHISHUA_AVX512_H
+#define SHISHUA_AVX512_H
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <immintrin.h>
+#include <assert.h>
+
+#define SHISHUA_AVX512_TARGET   __attribute__ ((target ("avx512f")))
+
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ == 12
+// Silence GCC-12 false positives about _mm512_undefined_epi32(), see https://gcc.gnu.org/PR105593
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#endif
+
+namespace Shishua::Avx512 {
+
+// The four 256-bit AVX2 states s0..s3 are paired into two 512-bit registers,
+// state[0] = s0 | s2 and state[1] = s1 | s3 with the first state in the low half.
+// This way each register uses a single shift and permutation and o0 | o1 needs
+// no lane crossing. The counter applies to s1 and s3, so it is kept in both halves.
+// Output is stored in generation order, output[0] = o0 | o1 and output[1] = o2 | o3.
+typedef struct prng_state {
+  __m512i state[2];
+  __m512i output[2];
+  __m512i counter;
+} prng_state;
+
+// Runtime check for AVX-512F, the functions below are compiled for it regardless of -march.
+static inline bool supported() {
+  return __builtin_cpu_supports("avx512f");
+}
+
+// buf's size must be a multiple of 128 bytes.
+// Produces the same stream as Shishua::Avx2 and Shishua::Scalar.
+SHISHUA_AVX512_TARGET
+static inline void prng_gen(prng_state *s, uint8_t buf[], size_t size) {
+  __m512i o01 = s->output[0], o23 = s->output[1],
+          s02 = s->state[0],  s13 = s->state[1],
+          t02, t13, u02, u13, counter = s->counter;
+  // The AVX2 rotations by 96 and 160 bits, applied to both 256-bit halves.
+  const __m512i shu0 = _mm512_set_epi32(12, 11, 10, 9, 8, 15, 14, 13, 4, 3, 2, 1, 0, 7, 6, 5),
+                shu1 = _mm512_set_epi32(10, 9, 8, 15, 14, 13, 12, 11, 2, 1, 0, 7, 6, 5, 4, 3);
+  // Counter increments as in the AVX2 version, for s1 and s3.
+  const __m512i increment = _mm512_set_epi64(1, 3, 5, 7, 1, 3, 5, 7);
+
+  // Whole 128 byte blocks only. Shishua::Rng is built on the compile time kernel, not on this
+  // runtime selected one, callers that need byte granular output must buffer blocks themselves.
+  assert((size % 128 == 0) && "buf's size must be a multiple of 128 bytes.");
+
+  for (size_t i = 0; i < size; i += 128) {
+    if (buf != NULL) {
+      _mm512_storeu_si512((__m512i*)&buf[i +  0], o01);
+      _mm512_storeu_si512((__m512i*)&buf[i + 64], o23);
+    }
+
+    s13 = _mm512_add_epi64(s13, counter);
+    counter = _mm512_add_epi64(counter, increment);
+
+    u02 = _mm512_srli_epi64(s02, 1);            u13 = _mm512_srli_epi64(s13, 3);
+    t02 = _mm512_permutexvar_epi32(shu0, s02);  t13 = _mm512_permutexvar_epi32(shu1, s13);
+    s02 = _mm512_add_epi64(t02, u02);           s13 = _mm512_add_epi64(t13, u13);
+
+    // o0 | o1 = (u0 ^ t1) | (u2 ^ t3) and o2 | o3 = (s0 ^ s3) | (s2 ^ s1)
+    o01 = _mm512_xor_si512(u02, t13);
+    o23 = _mm512_xor_si512(s02, _mm512_shuffle_i64x2(s13, s13, 0x4E));
+  }
+  s->output[0] = o01; s->output[1] = o23;
+  s->state [0] = s02; s->state [1] = s13;
+  s->counter = counter;
+}
+
+SHISHUA_AVX512_TARGET
+static inline void prng_init(prng_state *s, const uint64_t seed[4]) {
+  // Same hex digits of Φ as the AVX2 and scalar versions.
+  static const uint64_t phi[16] = {
+    0x9E3779B97F4A7C15, 0xF39CC0605CEDC834, 0x1082276BF3A27251, 0xF86C6A11D0C18E95,
+    0x2767F0B153D27B7F, 0x0347045B5BF1827F, 0x01886F0928403002, 0xC1D64BA40F335E36,
+    0xF06AD7AE9717877E, 0x85839D6EFFBD7DC6, 0x64D325D1C5371682, 0xCADD0CCCFDFFBBE1,
+    0x626E33B8D04B4331, 0xBBF73C790D94F79D, 0x471C4AB3ED3D82A5, 0xFEC507705E4AE6E5,
+  };
+  memset(s, 0, sizeof(prng_state));
+  constexpr unsigned STEPS = 1;
+  constexpr unsigned ROUNDS = 13;
+  s->state[0] = _mm512_set_epi64(phi[11], phi[10] ^ seed[3], phi[ 9], phi[ 8] ^ seed[2],
+                                 phi[ 3], phi[ 2] ^ seed[1], phi[ 1], phi[ 0] ^ seed[0]);
+  s->state[1] = _mm512_set_epi64(phi[15], phi[14] ^ seed[1], phi[13], phi[12] ^ seed[0],
+                                 phi[ 7], phi[ 6] ^ seed[3], phi[ 5], phi[ 4] ^ seed[2]);
+  for (size_t i = 0; i < ROUNDS; i++) {
+    prng_gen(s, NULL, 128 * STEPS);
+    // s0 | s2 = o3 | o1 and s1 | s3 = o2 | o0
+    s->state[0] = _mm512_shuffle_i64x2(s->output[1], s->output[0], 0xEE);
+    s->state[1] = _mm512_shuffle_i64x2(s->output[1], s->output[0], 0x44);
+  }
+}
+
+} // Shishua::Avx512
+
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ == 12
+#pragma GCC diagnostic pop
+#endif
+
+#undef SHISHUA_AVX512_TARGET
+
+#endif // SHISHUA_AVX512_H
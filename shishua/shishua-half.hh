@@ -0,0 +1,238 @@
+// Dedicated to the Public Domain under the Unlicense: https://unlicense.org/UNLICENSE
+
+// Based on https://github.com/espadrine/shishua/blob/master/shishua-half.h
+
+// Half width shishua: a single pair of 256-bit lanes and a single output lane,
+// producing 32 bytes per iteration. The state is 128 bytes instead of 288 bytes,
+// at the cost of roughly half the throughput of the full version.
+// All implementations below produce the same stream.
+#ifndef SHISHUA_HALF_H
+#define SHISHUA_HALF_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <assert.h>
+
+#if defined(__SSE2__)
+#  include <emmintrin.h>
+#endif // __SSE2__
+#if defined(__AVX2__)
+#  include <immintrin.h>
+#endif // __AVX2__
+
+namespace ShishuaHalf {
+
+// Nothing up my sleeve: those are the hex digits of Φ,
+// the least approximable irrational number.
+// $ echo 'scale=310;obase=16;(sqrt(5)-1)/2' | bc
+static const uint64_t phi[8] = {
+  0x9E3779B97F4A7C15, 0xF39CC0605CEDC834, 0x1082276BF3A27251, 0xF86C6A11D0C18E95,
+  0x2767F0B153D27B7F, 0x0347045B5BF1827F, 0x01886F0928403002, 0xC1D64BA40F335E36,
+};
+
+// The half version needs fewer rounds, but more steps per round to diffuse
+// the seed, each round reseeds s0 and s1 from the last two output blocks.
+constexpr unsigned INIT_STEPS = 5;
+constexpr unsigned INIT_ROUNDS = 4;
+
+} // ShishuaHalf
+
+ // ShishuaHalf Scalar version
+
+namespace ShishuaHalf::Scalar {
+
+// Note: While it is an array, a "lane" refers to 4 consecutive uint64_t.
+typedef struct prng_state {
+  uint64_t state[8];   // 2 lanes
+  uint64_t output[4];  // 1 lane
+  uint64_t counter[4]; // 1 lane
+} prng_state;
+
+// buf's size must be a multiple of 32 bytes.
+static inline void prng_gen(prng_state *__restrict state, uint8_t *__restrict buf, size_t size) {
+  uint64_t *s = state->state, *o = state->output;
+  // Whole 32 byte blocks only, byte granular output buffers them as Shishua::Rng does.
+  assert((size % 32 == 0) && "buf's size must be a multiple of 32 bytes.");
+
+  for (size_t i = 0; i < size; i += 32) {
+    // Write the current output block to state if it is not NULL
+    if (buf != NULL) {
+      for (size_t j = 0; j < 4; j++)
+        Shishua::Scalar::prng_write_le64(&buf[i + 8 * j], o[j]);
+    }
+    // I apply the counter to s1,
+    // since it is the one whose shift loses most entropy.
+    for (size_t k = 0; k < 4; k++)
+      s[k + 4] += state->counter[k];
+
+    // The 256-bit rotations by 96 and 160 of the full version, as funnel shifts.
+    const uint8_t shuf_offsets[16] = { 2,3,0,1, 5,6,7,4,   // left
+                                       3,0,1,2, 6,7,4,5 }; // right
+    uint64_t t[8];
+    for (size_t k = 0; k < 8; k++)
+      t[k] = (s[shuf_offsets[k]] >> 32) | (s[shuf_offsets[k + 8]] << 32);
+
+    for (size_t k = 0; k < 4; k++) {
+      uint64_t u_lo = s[k + 0] >> 1;
+      uint64_t u_hi = s[k + 4] >> 3;
+      s[k + 0] = u_lo + t[k + 0];
+      s[k + 4] = u_hi + t[k + 4];
+      // Only the first orthogonally grown piece is output.
+      o[k] = u_lo ^ t[k + 4];
+      state->counter[k] += 7 - (k * 2); // 7, 5, 3, 1
+    }
+  }
+}
+
+static inline void prng_init(prng_state *s, const uint64_t seed[4]) {
+  memset(s, 0, sizeof(prng_state));
+  uint8_t buf[32 * INIT_STEPS];
+  // Diffuse first two seed elements in s0, then the last two.
+  // We must keep half of the state unchanged so users cannot set a bad state.
+  memcpy(s->state, phi, sizeof(phi));
+  s->state[0] ^= seed[0]; s->state[2] ^= seed[1];
+  s->state[4] ^= seed[2]; s->state[6] ^= seed[3];
+  for (size_t i = 0; i < INIT_ROUNDS; i++) {
+    prng_gen(s, buf, sizeof(buf));
+    memcpy(&s->state[0], &buf[32 * (INIT_STEPS - 1)], 32);
+    memcpy(&s->state[4], &buf[32 * (INIT_STEPS - 2)], 32);
+  }
+}
+
+} // ShishuaHalf::Scalar
+
+#if defined(__SSE2__)
+
+ // ShishuaHalf SSE2 version
+
+namespace ShishuaHalf::Sse2 {
+
+typedef struct prng_state {
+  __m128i state[4];
+  __m128i output[2];
+  __m128i counter[2];
+} prng_state;
+
+// buf's size must be a multiple of 32 bytes.
+static inline void prng_gen(prng_state *__restrict s, uint8_t *__restrict buf, size_t size) {
+  using Shishua::Sse2::SHISHUA_ALIGNR_EPI8;
+  using Shishua::Sse2::SHISHUA_SET_EPI64X;
+  __m128i s0_lo = s->state[0], s0_hi = s->state[1], s1_lo = s->state[2], s1_hi = s->state[3],
+          o_lo = s->output[0], o_hi = s->output[1], counter_lo = s->counter[0], counter_hi = s->counter[1],
+          u0_lo, u0_hi, u1_lo, u1_hi, t0_lo, t0_hi, t1_lo, t1_hi;
+  // increment = { 7, 5, 3, 1 };
+  const __m128i increment_lo = SHISHUA_SET_EPI64X(5, 7);
+  const __m128i increment_hi = SHISHUA_SET_EPI64X(1, 3);
+
+  // Whole 32 byte blocks only, byte granular output buffers them as Shishua::Rng does.
+  assert((size % 32 == 0) && "buf's size must be a multiple of 32 bytes.");
+
+  for (size_t i = 0; i < size; i += 32) {
+    if (buf != NULL) {
+      _mm_storeu_si128((__m128i *)&buf[i +  0], o_lo);
+      _mm_storeu_si128((__m128i *)&buf[i + 16], o_hi);
+    }
+    s1_lo = _mm_add_epi64(s1_lo, counter_lo);
+    s1_hi = _mm_add_epi64(s1_hi, counter_hi);
+    counter_lo = _mm_add_epi64(counter_lo, increment_lo);
+    counter_hi = _mm_add_epi64(counter_hi, increment_hi);
+
+    u0_lo = _mm_srli_epi64(s0_lo, 1);  u0_hi = _mm_srli_epi64(s0_hi, 1);
+    u1_lo = _mm_srli_epi64(s1_lo, 3);  u1_hi = _mm_srli_epi64(s1_hi, 3);
+    // 256-bit rotations by 96 and 160, see Shishua::Sse2::prng_gen().
+    t0_lo = SHISHUA_ALIGNR_EPI8<4> (s0_lo, s0_hi);
+    t0_hi = SHISHUA_ALIGNR_EPI8<4> (s0_hi, s0_lo);
+    t1_lo = SHISHUA_ALIGNR_EPI8<12> (s1_hi, s1_lo);
+    t1_hi = SHISHUA_ALIGNR_EPI8<12> (s1_lo, s1_hi);
+    s0_lo = _mm_add_epi64(t0_lo, u0_lo);  s0_hi = _mm_add_epi64(t0_hi, u0_hi);
+    s1_lo = _mm_add_epi64(t1_lo, u1_lo);  s1_hi = _mm_add_epi64(t1_hi, u1_hi);
+
+    o_lo = _mm_xor_si128(u0_lo, t1_lo);
+    o_hi = _mm_xor_si128(u0_hi, t1_hi);
+  }
+  s->state[0] = s0_lo;  s->state[1] = s0_hi;  s->state[2] = s1_lo;  s->state[3] = s1_hi;
+  s->output[0] = o_lo;  s->output[1] = o_hi;
+  s->counter[0] = counter_lo;  s->counter[1] = counter_hi;
+}
+
+static inline void prng_init(prng_state *s, const uint64_t seed[4]) {
+  memset(s, 0, sizeof(prng_state));
+  uint8_t buf[32 * INIT_STEPS];
+  // Diffuse first two seed elements in s0, then the last two.
+  // We must keep half of the state unchanged so users cannot set a bad state.
+  for (size_t i = 0; i < 4; i++)
+    s->state[i] = _mm_xor_si128(Shishua::Sse2::SHISHUA_CVTSI64_SI128(seed[i]), _mm_loadu_si128((const __m128i *)&phi[2 * i]));
+  for (size_t i = 0; i < INIT_ROUNDS; i++) {
+    prng_gen(s, buf, sizeof(buf));
+    s->state[0] = _mm_loadu_si128((const __m128i *)&buf[32 * (INIT_STEPS - 1) +  0]);
+    s->state[1] = _mm_loadu_si128((const __m128i *)&buf[32 * (INIT_STEPS - 1) + 16]);
+    s->state[2] = _mm_loadu_si128((const __m128i *)&buf[32 * (INIT_STEPS - 2) +  0]);
+    s->state[3] = _mm_loadu_si128((const __m128i *)&buf[32 * (INIT_STEPS - 2) + 16]);
+  }
+}
+
+} // ShishuaHalf::Sse2
+
+#endif // __SSE2__
+
+#if defined(__AVX2__)
+
+ // ShishuaHalf AVX2 version
+
+namespace ShishuaHalf::Avx2 {
+
+typedef struct prng_state {
+  __m256i state[2];
+  __m256i output;
+  __m256i counter;
+} prng_state;
+
+// buf's size must be a multiple of 32 bytes.
+static inline void prng_gen(prng_state *s, uint8_t buf[], size_t size) {
+  __m256i o = s->output, s0 = s->state[0], s1 = s->state[1], t0, t1, u0, u1, counter = s->counter;
+  // The 256-bit rotations by 96 and 160 of the full version.
+  const __m256i shu0 = _mm256_set_epi32(4, 3, 2, 1, 0, 7, 6, 5),
+                shu1 = _mm256_set_epi32(2, 1, 0, 7, 6, 5, 4, 3);
+  const __m256i increment = _mm256_set_epi64x(1, 3, 5, 7);
+
+  // Whole 32 byte blocks only, byte granular output buffers them as Shishua::Rng does.
+  assert((size % 32 == 0) && "buf's size must be a multiple of 32 bytes.");
+
+  for (size_t i = 0; i < size; i += 32) {
+    if (buf != NULL)
+      _mm256_storeu_si256((__m256i*)&buf[i], o);
+
+    s1 = _mm256_add_epi64(s1, counter);
+    counter = _mm256_add_epi64(counter, increment);
+
+    u0 = _mm256_srli_epi64(s0, 1);              u1 = _mm256_srli_epi64(s1, 3);
+    t0 = _mm256_permutevar8x32_epi32(s0, shu0); t1 = _mm256_permutevar8x32_epi32(s1, shu1);
+    s0 = _mm256_add_epi64(t0, u0);              s1 = _mm256_add_epi64(t1, u1);
+
+    o = _mm256_xor_si256(u0, t1);
+  }
+  s->output = o;
+  s->state[0] = s0; s->state[1] = s1;
+  s->counter = counter;
+}
+
+static inline void prng_init(prng_state *s, const uint64_t seed[4]) {
+  memset(s, 0, sizeof(prng_state));
+  uint8_t buf[32 * INIT_STEPS];
+  // Diffuse first two seed elements in s0, then the last two.
+  // We must keep half of the state unchanged so users cannot set a bad state.
+  s->state[0] = _mm256_set_epi64x(phi[3], phi[2] ^ seed[1], phi[1], phi[0] ^ seed[0]);
+  s->state[1] = _mm256_set_epi64x(phi[7], phi[6] ^ seed[3], phi[5], phi[4] ^ seed[2]);
+  for (size_t i = 0; i < INIT_ROUNDS; i++) {
+    prng_gen(s, buf, sizeof(buf));
+    s->state[0] = _mm256_loadu_si256((const __m256i*)&buf[32 * (INIT_STEPS - 1)]);
+    s->state[1] = _mm256_loadu_si256((const __m256i*)&buf[32 * (INIT_STEPS - 2)]);
+  }
+}
+
+} // ShishuaHalf::Avx2
+
+#endif // __AVX2__
+
+#endif // SHISHUA_HALF_H
@@ -4,6 +4,7 @@
 
 #include <vector>
 #include <cstdio>
+#include <cstring>
 
 static void
 shishua_tests (const std::array<uint64_t, 4> &seeds)
@@ -64,4 +65,152 @@ shishua_stream_tests (const std::array<uint64_t, 4> &seeds)
     assert (orig == buffer);
     printf ("  OK    (AVX2 validation)\n");
   }
+#if defined(__AVX2__)
+  if (1 /*avx2 dual*/) {
+    std::array<uint64_t, 4> seeds2 = seeds;
+    seeds2[3] += 1;
+    std::vector<uint8_t> buffer2 (N / 2, 0);
+    Shishua::Scalar::prng_state state2{};
+    Shishua::Scalar::prng_init (&state2, seeds2.data());
+    Shishua::Scalar::prng_gen (&state2, buffer2.data(), buffer2.size());
+    buffer.assign (N, 0);
+    Shishua::Avx2::prng_state a{}, b{};
+    Shishua::Avx2::prng_init (&a, seeds.data());
+    Shishua::Avx2::prng_init (&b, seeds2.data());
+    Shishua::Avx2::prng_gen_dual (&a, &b, buffer.data(), 256 * 3);
+    Shishua::Avx2::prng_gen_dual (&a, &b, buffer.data() + 256 * 3, buffer.size() - 256 * 3);
+    for (size_t i = 0; i < N / 128; i++)
+      assert (0 == memcmp (&buffer[i * 128], i & 1 ? &buffer2[i / 2 * 128] : &orig[i / 2 * 128], 128));
+    printf ("  OK    (AVX2 dual state validation)\n");
+  }
+  if (1 /*avx2 non-temporal*/) {
+    std::vector<uint8_t> padded (N + 64 + 32, 0);
+    uint8_t *const aligned = (uint8_t*) ((uintptr_t (padded.data()) + 31) & ~uintptr_t (31));
+    for (size_t offset : { 0, 5, 32 }) {
+      Shishua::Avx2::prng_state nt_state{};
+      Shishua::Avx2::prng_init (&nt_state, seeds.data());
+      Shishua::Avx2::prng_gen_stream (&nt_state, aligned + offset, 128 * 3);
+      Shishua::Avx2::prng_gen_stream (&nt_state, aligned + offset + 128 * 3, N - 128 * 3);
+      assert (0 == memcmp (aligned + offset, orig.data(), N));
+    }
+    printf ("  OK    (AVX2 non-temporal validation)\n");
+  }
+#endif
+#if defined(SHISHUA_HAVE_AVX512)
+  if (Shishua::Avx512::supported()) {
+    buffer.assign (N, 0);
+    assert (orig != buffer);
+    Shishua::Avx512::prng_state avx512_state{};
+    Shishua::Avx512::prng_init (&avx512_state, seeds.data());
+    Shishua::Avx512::prng_gen (&avx512_state, buffer.data(), 128 * 7);
+    Shishua::Avx512::prng_gen (&avx512_state, buffer.data() + 128 * 7, buffer.size() - 128 * 7);
+    assert (orig == buffer);
+    printf ("  OK    (AVX512 validation)\n");
+  }
+#endif
+}
+
+static void
+shishua_rng_tests (const std::array<uint64_t, 4> &seeds)
+{
+  const unsigned N = 3 * 4096 + 7 * 128;
+  std::vector<uint8_t> orig (N, 0), buffer (N, 0);
+  Shishua::prng_state state{};
+  Shishua::prng_init (&state, seeds.data());
+  Shishua::prng_gen (&state, orig.data(), orig.size());
+  // mixed draws must reproduce the byte stream
+  const size_t sizes[] = { 1, 8, 3, 0, 129, 4096, 5, 8, 8, 4095, 16, 8192 + 77 };
+  Shishua::Rng rng { seeds };
+  size_t pos = 0;
+  for (size_t i = 0; pos < N; i++) {
+    const size_t n = std::min (sizes[i % (sizeof (sizes) / sizeof (sizes[0]))], N - pos);
+    if (n == 8) {
+      const uint64_t v = rng.next64();
+      memcpy (&buffer[pos], &v, 8);
+    } else
+      rng.fill (&buffer[pos], n);
+    pos += n;
+  }
+  assert (orig == buffer);
+  // discard() skips 8 bytes per value
+  Shishua::Rng r1 { seeds }, r2 { seeds };
+  for (size_t skip : { 0, 1, 17, 511, 512, 1000, 3 }) {
+    r1.discard (skip);
+    for (size_t i = 0; i < skip; i++)
+      r2.next64();
+    assert (r1.next64() == r2.next64());
+  }
+  uint8_t byte;
+  r1.fill (&byte, 1);
+  r2.fill (&byte, 1);
+  r1.discard (1000);
+  r2.discard (1000);
+  assert (r1() == r2());
+  printf ("  OK    Shishua::Rng next64(), fill() and discard()\n");
+}
+
+template<class State, void (*init) (State*, const uint64_t*), void (*init_many) (State*, const uint64_t*, size_t)> static void
+shishua_init_many_tests (const char *name)
+{
+  constexpr size_t N = 7;
+  uint64_t seeds[4 * N];
+  for (size_t i = 0; i < 4 * N; i++)
+    seeds[i] = i * 0x9E3779B97F4A7C15;
+  State many[N], single;
+  memset (many, 0, sizeof (many));
+  init_many (many, seeds, N);
+  for (size_t i = 0; i < N; i++) {
+    init (&single, seeds + 4 * i);
+    assert (0 == memcmp (&single, &many[i], sizeof (single)));
+  }
+  printf ("  OK    %s::prng_init_many() matches prng_init()\n", name);
+}
+
+static void
+shishua_half_tests (const std::array<uint64_t, 4> &seeds)
+{
+  static_assert (2 * sizeof (ShishuaHalf::Scalar::prng_state) <= sizeof (Shishua::Scalar::prng_state));
+  static_assert (2 * sizeof (ShishuaHalf::Avx2::prng_state) <= sizeof (Shishua::Avx2::prng_state));
+  const unsigned N = 4 * 1024 * 1024;
+  std::vector<uint8_t> buffer (N, 0);
+  ShishuaHalf::Scalar::prng_state orig_state{};
+  ShishuaHalf::Scalar::prng_init (&orig_state, seeds.data());
+  ShishuaHalf::Scalar::prng_gen (&orig_state, buffer.data(), buffer.size());
+  const std::vector<uint8_t> orig (buffer);
+  // bit toggles of consecutive 64-bit words
+  uint bits[64] = { 0, };
+  uint64_t last = 0;
+  for (size_t i = 0; i < N; i += 8) {
+    uint64_t c;
+    memcpy (&c, &orig[i], 8);
+    for (uint j = 0; j <= 63; j++)
+      bits[j] += ((c ^ last) >> j) & 1;
+    last = c;
+  }
+  for (uint j = 0; j <= 63; j++) {
+    const double bit_perc = bits[j] * 100.0 / (N / 8);
+    assert (bit_perc >= 49 && bit_perc <= 51);
+  }
+  // generating in pieces yields the same stream
+  ShishuaHalf::Scalar::prng_init (&orig_state, seeds.data());
+  for (size_t i = 0; i < N; i += 32 * 3)
+    ShishuaHalf::Scalar::prng_gen (&orig_state, buffer.data() + i, std::min<size_t> (32 * 3, N - i));
+  assert (orig == buffer);
+  printf ("  OK    ShishuaHalf bit toggles\n");
+#if defined(__SSE2__)
+  buffer.assign (N, 0);
+  ShishuaHalf::Sse2::prng_state sse2_state{};
+  ShishuaHalf::Sse2::prng_init (&sse2_state, seeds.data());
+  ShishuaHalf::Sse2::prng_gen (&sse2_state, buffer.data(), buffer.size());
+  assert (orig == buffer);
+  printf ("  OK    ShishuaHalf (SSE2 validation)\n");
+#endif
+#if defined(__AVX2__)
+  buffer.assign (N, 0);
+  ShishuaHalf::Avx2::prng_state avx2_state{};
+  ShishuaHalf::Avx2::prng_init (&avx2_state, seeds.data());
+  ShishuaHalf::Avx2::prng_gen (&avx2_state, buffer.data(), buffer.size());
+  assert (orig == buffer);
+  printf ("  OK    ShishuaHalf (AVX2 validation)\n");
+#endif
 }
@@ -13,6 +13,11 @@
 #  include "shishua-sse2.hh"
 #endif // __AVX2__
 
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#  define SHISHUA_HAVE_AVX512   1       // selected at runtime via Avx512::supported()
+#  include "shishua-avx512.hh"
+#endif // __x86_64__
+
  // Shishua Scalar version
 
 // Portable scalar implementation of shishua.
@@ -21,6 +26,8 @@
 #include <stddef.h>
 #include <string.h>
 #include <assert.h>
+#include <array>
+#include <algorithm>
 
 namespace Shishua::Scalar {
 
@@ -50,7 +57,7 @@ static inline void prng_write_le64(void *dst, uint64_t val) {
 // buf's size must be a multiple of 128 bytes.
 static inline void prng_gen(prng_state *__restrict state, uint8_t *__restrict buf, size_t size) {
   uint8_t *b = buf;
-  // TODO: consider adding proper uneven write handling
+  // Whole 128 byte blocks only, Shishua::Rng buffers them for byte granular output.
   assert((size % 128 == 0) && "buf's size must be a multiple of 128 bytes.");
 
   for (size_t i = 0; i < size; i += 128) {
@@ -197,6 +204,14 @@ static inline void prng_init(prng_state *s, const uint64_t seed[4]) {
   }
 }
 
+// Same as calling prng_init(&states[i], seeds + 4 * i) for all i < n.
+// This is a plain loop: the state does not fit into registers, so interleaving
+// two states here only adds spills (measured 0.78x scalar, 0.85x SSE2).
+static inline void prng_init_many(prng_state *states, const uint64_t *seeds, size_t n) {
+  for (size_t i = 0; i < n; i++)
+    prng_init(&states[i], seeds + 4 * i);
+}
+
 } // Shishua::Scalar
 
 /// Namespace containing the fastest Shishua for the current compiler target.
@@ -208,6 +223,97 @@ using namespace Sse2;
 #else
 using namespace Scalar;
 #endif
+
+/** Rng - Buffered Shishua generator with byte granular output.
+ *
+ * Output is the Shishua byte stream of the fastest compile time variant,
+ * independent of how it is drawn: next64() consumes 8 bytes, fill() any
+ * number of bytes. Small draws are served from an internal buffer that is
+ * refilled in 4KB batches, large fill() requests are generated in place.
+ */
+class Rng {
+  static constexpr size_t BUFFER_SIZE = 4096;   // multiple of 128
+  prng_state state_{};
+  alignas (64) uint8_t buffer_[BUFFER_SIZE];
+  size_t pos_ = BUFFER_SIZE;
+  void
+  refill()
+  {
+    prng_gen (&state_, buffer_, BUFFER_SIZE);
+    pos_ = 0;
+  }
+public:
+  using result_type = uint64_t;
+  /// Construct an instance and call `seed (s)`.
+  explicit Rng (const std::array<uint64_t,4> &s) { seed (s); }
+  /// Construct an instance with a fixed seed, dynamic seeding is recommended.
+  explicit Rng () { seed ({ 0, 0, 0, 0 }); }
+  /// Reinitialize the generator state and drop buffered output.
+  void
+  seed (const std::array<uint64_t,4> &s)
+  {
+    prng_init (&state_, s.data());
+    pos_ = BUFFER_SIZE;
+  }
+  /// Generate the next 8 bytes of the stream as a native 64 bit integer.
+  uint64_t
+  next64()
+  {
+    uint64_t v;
+    if (__builtin_expect (pos_ + 8 <= BUFFER_SIZE, true)) {
+      memcpy (&v, buffer_ + pos_, 8);
+      pos_ += 8;
+    } else
+      fill (&v, 8);
+    return v;
+  }
+  uint64_t operator() () { return next64(); }
+  static constexpr uint64_t min() { return 0; }
+  static constexpr uint64_t max() { return ~uint64_t (0); }
+  /// Fill `nbytes` of `dest` with the next bytes of the stream.
+  void
+  fill (void *dest, size_t nbytes)
+  {
+    uint8_t *d = (uint8_t*) dest;
+    size_t n = std::min (nbytes, BUFFER_SIZE - pos_);
+    memcpy (d, buffer_ + pos_, n);
+    pos_ += n;
+    d += n;
+    nbytes -= n;
+    if (nbytes >= BUFFER_SIZE) { // buffer is empty, generate in place
+      n = nbytes / 128 * 128;
+      prng_gen (&state_, d, n);
+      d += n;
+      nbytes -= n;
+    }
+    if (nbytes) {
+      refill();
+      memcpy (d, buffer_, nbytes);
+      pos_ = nbytes;
+    }
+  }
+  /// Skip the next `count` 64 bit values, i.e. `8 * count` bytes of the stream.
+  void
+  discard (unsigned long long count)
+  {
+    uint64_t nbytes = count * 8;
+    size_t n = std::min (nbytes, uint64_t (BUFFER_SIZE - pos_));
+    pos_ += n;
+    nbytes -= n;
+    if (nbytes >= BUFFER_SIZE) { // generate without storing output
+      n = nbytes / 128 * 128;
+      prng_gen (&state_, NULL, n);
+      nbytes -= n;
+    }
+    if (nbytes) {
+      refill();
+      pos_ = nbytes;
+    }
+  }
+};
+
 } // Shishua
 
+#include "shishua-half.hh"
+
 #endif // SHISHUA_H